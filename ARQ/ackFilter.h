@@ -0,0 +1,173 @@
+#ifndef ACK_FILTER_H
+#define ACK_FILTER_H
+
+// TCP ack thinning in the egress queue.
+// A download through the link makes the other side send a steady stream of pure tcp acks, each one costing two
+// fragments and their acknowledgements on air. An ack is cumulative, so a pure ack still waiting in the
+// outgoing pipe says nothing once a newer ack of the same flow is queued behind it: the tun reader marks it
+// superseded and the sender skips it.
+// Only what a newer ack really covers is dropped, an older ack is kept when:
+// - the newer one does not acknowledge more (duplicate acks drive fast retransmit, same ack + other window is a window update)
+// - it carries data, sack blocks or any option besides timestamps, or flags besides ack / ece
+// - it echoes congestion (ece) and the newer one doesn't
+// Acks are never reordered, the newer one simply takes the place of the dropped one in the stream.
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+// the flow of a segment: ipv4 source and destination address, tcp source and destination port
+#define ACK_FILTER_FLOW_SIZE 12
+// slots of the flow table (a flow maps to one, another flow in the same slot just replaces it)
+#define ACK_FILTER_SLOTS 16
+
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_SYN 0x02
+#define TCP_FLAG_RST 0x04
+#define TCP_FLAG_ACK 0x10
+#define TCP_FLAG_ECE 0x40
+
+// state of a packet buffer in the outgoing pipe, the sender and the tun reader race for a queued one
+enum QueuedState {
+    QUEUED_WAITING,
+    QUEUED_TAKEN,           // the sender has it
+    QUEUED_SUPERSEDED       // the tun reader dropped it, the sender only gives the buffer back
+};
+
+// what the filter needs to know of a tcp segment
+struct TcpSegment {
+    uint8_t flow[ACK_FILTER_FLOW_SIZE];
+    uint32_t ack;
+    uint8_t flags;
+    bool pureAck;           // no data, only the ack (and ece) flag and at most timestamps as options
+};
+
+class AckFilter {
+public:
+    AckFilter() : enabled(true), superseded(0), nextSerial(0) {
+        memset(slots, 0, sizeof(slots));
+    }
+
+    // the tun reader calls this for every packet before it queues it (only the tun reader writes the table)
+    template <typename Buffer>
+    void queue(Buffer* packet) {
+        packet->queuedState.store(QUEUED_WAITING, std::memory_order_relaxed);
+        packet->serial = ++nextSerial;
+        TcpSegment segment;
+        if(!enabled || !parse(packet->data, packet->length, segment)) {
+            return;
+        }
+        Slot& slot = slots[hash(segment) % ACK_FILTER_SLOTS];
+        bool sameFlow = slot.packet != NULL && memcmp(slot.segment.flow, segment.flow, ACK_FILTER_FLOW_SIZE) == 0;
+        if(sameFlow && covers(segment, slot.segment)) {
+            Buffer* older = static_cast<Buffer*>(slot.packet);
+            // the buffer may have been sent and reused since, then its serial is another one
+            uint8_t expected = QUEUED_WAITING;
+            if(older->serial == slot.serial
+               && older->queuedState.compare_exchange_strong(expected, QUEUED_SUPERSEDED, std::memory_order_acq_rel)) {
+                superseded.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if(segment.pureAck) {
+            slot.packet = packet;
+            slot.serial = packet->serial;
+            slot.segment = segment;
+        } else if(sameFlow) {
+            slot.packet = NULL;
+        }
+    }
+
+    // the sender calls this for every packet it takes from the pipe, false = skip it (superseded)
+    template <typename Buffer>
+    bool take(Buffer* packet) {
+        return packet->queuedState.exchange(QUEUED_TAKEN, std::memory_order_acq_rel) != QUEUED_SUPERSEDED;
+    }
+
+    bool enabled;   // set before the threads start
+    std::atomic<uint64_t> superseded;
+
+private:
+    struct Slot {
+        void* packet;           // the last pure ack of the flow queued, NULL if none
+        uint32_t serial;
+        TcpSegment segment;
+    };
+
+    // true when the newer segment makes the older pure ack redundant
+    static bool covers(const TcpSegment& newer, const TcpSegment& older) {
+        if((newer.flags & TCP_FLAG_ACK) == 0 || (newer.flags & (TCP_FLAG_SYN | TCP_FLAG_RST)) != 0) {
+            return false;
+        }
+        if((older.flags & TCP_FLAG_ECE) != 0 && (newer.flags & TCP_FLAG_ECE) == 0) {
+            return false;
+        }
+        // acknowledges strictly more (modulo 2^32)
+        return static_cast<int32_t>(newer.ack - older.ack) > 0;
+    }
+
+    static uint32_t hash(const TcpSegment& segment) {
+        uint32_t value = 2166136261u;
+        for(int i = 0; i < ACK_FILTER_FLOW_SIZE; ++i) {
+            value = (value ^ segment.flow[i]) * 16777619u;
+        }
+        return value;
+    }
+
+    // ipv4 (not fragmented) carrying tcp, the tun reader passes only ipv4 on (see process_received_packet)
+    static bool parse(const uint8_t* packet, ssize_t size, TcpSegment& segment) {
+        if(size < 20 || (packet[0] >> 4) != 4) {
+            return false;
+        }
+        size_t ipHeaderLength = (packet[0] & 0x0F) * 4;
+        size_t ipLength = (packet[2] << 8) | packet[3];
+        // more fragments flag or a fragment offset
+        if(packet[9] != 6 || ((packet[6] & 0x3F) | packet[7]) != 0) {
+            return false;
+        }
+        memcpy(segment.flow, packet + 12, 8);
+        if(ipLength > static_cast<size_t>(size) || ipLength < ipHeaderLength + 20) {
+            return false;
+        }
+        const uint8_t* tcp = packet + ipHeaderLength;
+        size_t tcpHeaderLength = (tcp[12] >> 4) * 4;
+        if(tcpHeaderLength < 20 || ipHeaderLength + tcpHeaderLength > ipLength) {
+            return false;
+        }
+        memcpy(segment.flow + 8, tcp, 4);
+        segment.ack = (static_cast<uint32_t>(tcp[8]) << 24) | (tcp[9] << 16) | (tcp[10] << 8) | tcp[11];
+        segment.flags = tcp[13];
+        segment.pureAck = ipLength == ipHeaderLength + tcpHeaderLength
+                          && (segment.flags & ~TCP_FLAG_ECE) == TCP_FLAG_ACK
+                          && onlyTimestamps(tcp + 20, tcpHeaderLength - 20);
+        return true;
+    }
+
+    // sack blocks, window scale or anything unknown make an ack worth keeping
+    static bool onlyTimestamps(const uint8_t* options, size_t length) {
+        size_t i = 0;
+        while(i < length) {
+            if(options[i] == 0) {           // end of options
+                return true;
+            } else if(options[i] == 1) {    // no operation
+                ++i;
+            } else if(options[i] == 8 && i + 1 < length && options[i + 1] == 10) {
+                i += 10;
+            } else {
+                return false;
+            }
+        }
+        return i == length;
+    }
+
+    Slot slots[ACK_FILTER_SLOTS];
+    uint32_t nextSerial;
+};
+
+// the one ack filter of the outgoing pipe
+inline AckFilter& ackFilter() {
+    static AckFilter instance;
+    return instance;
+}
+
+#endif
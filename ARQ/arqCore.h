@@ -0,0 +1,1314 @@
+#ifndef ARQ_CORE_H
+#define ARQ_CORE_H
+
+// The protocol core of the ARQ programs, ourArq.cpp and negAckArq.cpp only pick the default acknowledgement policy.
+// ArqCore is instantiated for the frame geometry (frame size of the link, plain or --piggyback frames, see
+// frameGeometry.h), its sender and receiver for every policy (see arqPolicy.h): the sender picks the instantiation per
+// ip packet, the receiver per frame by the policy the peer announced, inside them the policy is known at compile time.
+// The frames go over the two nRF24 radios, or over udp with --udp-link (udpLink.h).
+
+#include <RF24/RF24.h>
+#include <iostream>
+#include <thread>
+#include <fstream>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <fcntl.h>
+#include <string.h>
+#include <cmath>
+#include <signal.h>
+#include "frameCapture.h"
+#include "asyncLog.h"
+#include "controlFrames.h"
+#include "arqPolicy.h"
+#include "frameGeometry.h"
+#include "trafficClass.h"
+#include "session.h"
+#include "netConfig.h"
+#include "hotRestart.h"
+#include "pipeline.h"
+#include "tunRing.h"
+#include "txArbiter.h"
+#include "tcpProxy.h"
+#include "linkMtu.h"
+#include "linkCrypto.h"
+#include "crc32c.h"
+#include "udpLink.h"
+#include "realtime.h"
+#include "flowControl.h"
+#include "txPacer.h"
+#include "fastPath.h"
+
+// PINS on the Buses connected to the raspberry -----------------------------------------------------
+#define RADIO_ONE_CE_PIN 17
+#define RADIO_ONE_CSN_PIN 0
+#define RADIO_TWO_CE_PIN 27
+#define RADIO_TWO_CSN_PIN 10
+// name of the virtual interface created
+#define I_FACE "tun0"
+// interface of the base station towards the internet
+#define UPLINK_FACE "eth0"
+#define BASE_ADDRESS "192.168.2.1"
+#define MOBILE_ADDRESS "192.168.2.2"
+// buffer where we store the packet from interface (iface mtu set to 1500 ... this should be enough)
+#define BUFFER_SIZE 2048
+static_assert(BUFFER_SIZE <= HANDOVER_REASSEMBLY_SIZE && BUFFER_SIZE <= PACKET_BUFFER_SIZE, "the packet being reassembled must fit into the handover state and a pipeline buffer");
+// --------------------------------------------------------------------------------------------------
+
+// the interface is set up by the program, a persistent one left behind by a previous run (e.g. after a crash) is reused
+// because the program sets up the interface, it must be executed as sudo
+
+const uint8_t addressWidth = 3;
+
+const uint8_t addressMobile[4] = "MOB";
+const uint8_t addressBase[4] = "BAS";
+
+// Function to set up the radio for sending
+inline void setupSendRadio(RF24& radio, bool baseStation) {
+    radio.begin();
+    radio.setPALevel(RF24_PA_LOW);
+    radio.setDataRate(RF24_2MBPS);
+    radio.setAddressWidth(addressWidth);
+    radio.setAutoAck(false);
+    // frames go on air with their real length (an ack is 1 byte instead of 32), both radios of the link must have it
+    radio.enableDynamicPayloads();
+    if(baseStation) {
+        radio.openWritingPipe(addressMobile); // address, used in the header, outgoing traffic contains this address (to whom?)
+        radio.setChannel(76);
+    } else {
+        radio.openWritingPipe(addressBase);
+        radio.setChannel(100);
+    }
+
+}
+
+// Function to set up the radio for receiving
+inline void setupReceiveRadio(RF24& radio, bool baseStation) {
+    radio.begin();
+    radio.setPALevel(RF24_PA_LOW);
+    radio.setDataRate(RF24_2MBPS);
+    radio.setAddressWidth(addressWidth);
+    radio.setAutoAck(false);
+    // frames go on air with their real length (an ack is 1 byte instead of 32), both radios of the link must have it
+    radio.enableDynamicPayloads();
+    if(baseStation) {
+        radio.openReadingPipe(1, addressBase); // address of the listening pipe which will be opened (our address?)
+        radio.setChannel(100);
+    } else {
+        radio.openReadingPipe(1, addressMobile);
+        radio.setChannel(76);
+    }
+    radio.startListening();
+}
+
+// function that checks, if the given packet_data form a proper ip packet: an ipv4 header with the right total length
+// and checksum (the rest of a received packet is covered by its crc, see crc32c.h, no need to parse it)
+inline bool process_received_packet(const uint8_t* packet_data, ssize_t packet_size) {
+    if(packet_size < 20 || (packet_data[0] >> 4) != 4) {
+        return false;
+    }
+    int headerLength = (packet_data[0] & 0x0F) * 4;
+    int totalLength = (packet_data[2] << 8) | packet_data[3];
+    if(headerLength < 20 || headerLength > packet_size || totalLength != packet_size) {
+        return false;
+    }
+    uint32_t sum = 0;
+    for(int i = 0; i < headerLength; i += 2) {
+        sum += (packet_data[i] << 8) | packet_data[i + 1];
+    }
+    while((sum >> 16) != 0) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return sum == 0xFFFF;
+}
+
+template <typename Geometry>
+class ArqCore {
+    static_assert(Geometry::maxPacket <= BUFFER_SIZE, "the largest ip packet must fit into the buffer");
+public:
+    ArqCore(PacketPipe& outgoingPipe, PacketPipe& incomingPipe, ArqPolicyId arqPolicy)
+        : policy(arqPolicy), hadToResend(0), allSent(0), abortedPackets(0), writerDrops(0), abortsUnconfirmed(0), outgoing(outgoingPipe), incoming(incomingPipe),
+          packetReceivedOnOtherSide(false), blockAcks(0), confirmedPolicy(ARQ_POLICY_NONE), announcedPolicy(ARQ_POLICY_NONE),
+          corruptReported(false), crcFailures(0), assembling(NULL), buffer(NULL), receivingAltBool(true), receivePolicy(ARQ_POLICY_NONE) {
+        for(int i = 0; i < 64; ++i) {
+            fragmentAcks[i] = 0;
+        }
+        // the bit of the second most significant bit in sent msgs, thus in received acks
+        sendingAltBool = hotRestart().resumed ? hotRestart().state.sendingAltBool != 0 : true;
+        resetReassembly();
+    }
+
+    // Function to send data (the sender thread)
+    void sendData() {
+        realtime().enter(RT_SENDER);
+        txPacer().start();
+        PacketBuffer* packet = NULL;
+
+        while (true) {
+            // the previous packet is done, its buffer goes back to the tun reader once the tx arbiter sent its last frame
+            if(packet != NULL) {
+                txArbiter().waitReleased(packet->references);
+                outgoing.freeBuffers.push(packet);
+                packet = NULL;
+            }
+            // if a new process takes over, we stop here, between packets, once the tun reader stopped and we sent what it read
+            if(outgoing.packets.empty() && hotRestart().shouldPark(STAGE_SENDER)) {
+                hotRestart().state.sendingAltBool = sendingAltBool;
+                hotRestart().park(STAGE_SENDER);
+            }
+            // the next ip packet, read and checked by the tun reader
+            packet = outgoing.packets.pop(PIPELINE_POLL_MS);
+            if(packet == NULL) {
+                continue;
+            }
+            // a newer tcp ack of the same flow was queued behind it, its buffer goes back at the top of the loop
+            if(!ackFilter().take(packet)) {
+                LOG_TRACE(LOG_SEND, "Skipped superseded tcp ack, skipped so far: {}", ackFilter().superseded.load());
+                continue;
+            }
+            const uint8_t* data = packet->data;
+            ssize_t bytes_read = packet->length;
+
+            LOG_DEBUG(LOG_SEND, "Sending ip packet from interface, {} bytes", bytes_read);
+
+            TrafficClass trafficClass = packet->trafficClass;
+            trafficPolicy().stats[trafficClass].sent.fetch_add(1, std::memory_order_relaxed);
+            std::chrono::steady_clock::time_point packetStart = packet->readAt;
+            int resendRounds = 0;
+            bool expired = false;
+
+            // while we hold the lock, the receiving thread can't reset our sending state (it asks us to do it instead)
+            std::unique_lock<std::mutex> sessionLock(session().senderMutex);
+            auto resetSending = [this]() { resetSendingState(); };
+            session().applyPendingReset(resetSending);
+            // no data before the peer knows our epoch
+            while(!session().established.load() && !trafficPolicy().exhausted(trafficClass, packetStart, 0, expired)) {
+                sessionLock.unlock();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                sessionLock.lock();
+                session().applyPendingReset(resetSending);
+            }
+            if(!session().established.load() || !session().peerAlive()) {
+                session().droppedPeerDead.fetch_add(1, std::memory_order_relaxed);
+                trafficPolicy().recordDrop(trafficClass, true);
+                LOG_DEBUG(LOG_SEND, "Dropped ip packet, no session with the peer, dropped so far: {}", session().droppedPeerDead.load());
+                continue;
+            }
+            // the peer has no buffer for another packet, it would drop it once it has all of it (see flowControl.h)
+            if(!flowControl().hasPacketCredit()) {
+                flowControl().creditStalls.fetch_add(1, std::memory_order_relaxed);
+                while(!flowControl().hasPacketCredit() && session().peerAlive() && !trafficPolicy().exhausted(trafficClass, packetStart, 0, expired)) {
+                    sessionLock.unlock();
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    sessionLock.lock();
+                    session().applyPendingReset(resetSending);
+                }
+                if(!flowControl().hasPacketCredit()) {
+                    trafficPolicy().recordDrop(trafficClass, expired);
+                    LOG_INFO(LOG_SEND, "Dropped ip packet of class {}, the peer had no buffer for it", trafficClass);
+                    continue;
+                }
+            }
+
+            // the receiver takes the size from the ip header in fragment 1 (there is no start message), so it has to be right
+            uint16_t headerSize;
+            if(!packetSizeOf(data, Geometry::maxPacket, headerSize) || headerSize != bytes_read) {
+                trafficPolicy().recordDrop(trafficClass, false);
+                LOG_WARN(LOG_SEND, "Dropped ip packet of {} bytes, its header says {} bytes", bytes_read, headerSize);
+                continue;
+            }
+            if(packet->length + (linkCrypto().enabled ? LINK_CRYPTO_OVERHEAD : 0) + CRC32C_SIZE > Geometry::maxPacket) {
+                trafficPolicy().recordDrop(trafficClass, false);
+                LOG_WARN(LOG_SEND, "Dropped ip packet of {} bytes, too large for the fragments", bytes_read);
+                continue;
+            }
+            // with --psk the packet is sealed once, its tag covers all of its fragments (see linkCrypto.h)
+            if(linkCrypto().enabled) {
+                linkCrypto().seal(packet->data, packet->length, session().localEpoch, session().peerEpoch.load(), LINK_CHANNEL_ARQ);
+            }
+            // the crc of the packet (as sent, sealed or not) goes behind it, the receiver checks it before it concludes the packet
+            appendCrc32c(packet->data, packet->length);
+            packet->length += CRC32C_SIZE;
+            // the receiver of the peer has to know the policy of the packet before its first fragment
+            ArqPolicyId packetPolicy = policy == ARQ_POLICY_HYBRID ? hybrid.current : policy;
+            if(announcedPolicy != packetPolicy && !announcePolicy(packetPolicy, trafficClass, packetStart, expired)) {
+                bool restarted = session().applyPendingReset(resetSending);
+                trafficPolicy().recordDrop(trafficClass, expired && !restarted);
+                LOG_INFO(LOG_SEND, "Dropped ip packet of class {}, the peer did not confirm the policy {}", trafficClass, packetPolicy);
+                continue;
+            }
+            // the ip packet is framed once (as many fragments as the receiver calculates), the resends send the same frames
+            uint8_t fragmentsToSend = framePacket<Geometry>(packet, sendingAltBool);
+            allSent += fragmentsToSend;
+            int resentBefore = hadToResend;
+
+            // then we send the actual data, the policy decides what is resent
+            bool abandoned;
+            switch(packetPolicy) {
+            case ARQ_POLICY_NAK:
+                abandoned = sendFragments<NegativeAck>(packet, fragmentsToSend, trafficClass, packetStart, resendRounds, expired);
+                break;
+            case ARQ_POLICY_BLOCK:
+                abandoned = sendFragments<BlockAck>(packet, fragmentsToSend, trafficClass, packetStart, resendRounds, expired);
+                break;
+            default:
+                abandoned = sendFragments<PositiveAck>(packet, fragmentsToSend, trafficClass, packetStart, resendRounds, expired);
+                break;
+            }
+            // the loss the mtu (and the hybrid policy) adapts to
+            linkMtu().record(fragmentsToSend, hadToResend - resentBefore);
+            txPacer().record(fragmentsToSend, hadToResend - resentBefore);
+            if(policy == ARQ_POLICY_HYBRID) {
+                hybrid.next(fragmentsToSend, hadToResend - resentBefore);
+            }
+            if(session().applyPendingReset(resetSending)) {
+                trafficPolicy().recordDrop(trafficClass, false);
+                LOG_INFO(LOG_SEND, "Dropped ip packet of class {}, the peer restarted", trafficClass);
+                continue;
+            }
+            if(abandoned) {
+                abortPacket(trafficClass);
+                if(session().applyPendingReset(resetSending)) {
+                    trafficPolicy().recordDrop(trafficClass, expired);
+                    continue;
+                }
+                trafficPolicy().recordDrop(trafficClass, expired);
+                LOG_INFO(LOG_SEND, "Dropped ip packet of class {} ({} = lifetime, 0 = retry budget) after {} resend rounds, dropped in class so far: {}",
+                         trafficClass, expired, resendRounds, trafficPolicy().dropped(trafficClass));
+            } else {
+                trafficPolicy().stats[trafficClass].delivered.fetch_add(1, std::memory_order_relaxed);
+            }
+            // after the packet is received on the other side (or was aborted), we can alternate the bool, thus the bit in the header for next ip packet
+            LOG_DEBUG(LOG_SEND, "Packet received on other side, total messages sent with radios: {}, had to resend: {}", allSent, hadToResend);
+            sendingAltBool = !sendingAltBool;
+            packetReceivedOnOtherSide = false;
+
+            // and we have to reset the fragmentAcks array
+            for(int i = 0; i < 64 ; ++i) {
+                fragmentAcks[i] = 0;
+            }
+        }
+    }
+
+    // Function to receive data (the receiver thread), from an RF24 radio or the udp link
+    template <typename Radio>
+    void receiveData(Radio& radioReceive) {
+        realtime().enter(RT_RECEIVER);
+        // the packet is reassembled right in a pipeline buffer, which goes to the tun writer when complete
+        assembling = incoming.freeBuffers.tryPop();
+        buffer = assembling->data;
+        uint8_t currentMsg[Geometry::frameSize] = {0};
+        std::chrono::steady_clock::time_point frameFound;
+        bool draining = false;
+
+        // continue with the packet the previous process was receiving
+        if(hotRestart().resumed) {
+            HandoverState& state = hotRestart().state;
+            receivingAltBool = state.receivingAltBool != 0;
+            receivePolicy = state.receivePolicy;
+            corruptPending = state.corruptPending != 0;
+            sizeKnown = state.sizeKnown != 0;
+            fragmentsReceived = state.fragmentsReceived;
+            fragmentsToReceive = state.fragmentsToReceive;
+            currentPacketSize = state.currentPacketSize;
+            for(int i = 0; i < 64; ++i) {
+                fragmentStatus[i] = state.fragments[i];
+            }
+            memcpy(buffer, state.reassembly, BUFFER_SIZE);
+        }
+
+        // the main receiving loop
+        while (true) {
+            // a new process takes over -> it gets what we have of the packet being received
+            if(hotRestart().shouldPark(STAGE_RECEIVER)) {
+                HandoverState& state = hotRestart().state;
+                state.receivingAltBool = receivingAltBool;
+                state.receivePolicy = receivePolicy;
+                state.corruptPending = corruptPending;
+                state.sizeKnown = sizeKnown;
+                state.fragmentsReceived = fragmentsReceived;
+                state.fragmentsToReceive = fragmentsToReceive;
+                state.currentPacketSize = currentPacketSize;
+                for(int i = 0; i < 64; ++i) {
+                    state.fragments[i] = fragmentStatus[i];
+                }
+                memcpy(state.reassembly, buffer, BUFFER_SIZE);
+                hotRestart().park(STAGE_RECEIVER);
+            }
+            // how long the last frame took us, from finding it in the radio to being back here (see flowControl.h)
+            if(draining) {
+                flowControl().recordDrain(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - frameFound).count());
+                draining = false;
+            }
+            // hello / keepalive to the peer and watching if it is still alive
+            session().tick();
+            // the buffers we have for its packets and how fast we drain the radio, to the sender of the peer
+            if(session().established.load()) {
+                flowControl().advertise(static_cast<int>(incoming.freeBuffers.size()));
+            }
+            // we wait for a message, and after it arrives, we read it (under SCHED_FIFO not spinning, see realtime.h)
+            if (!radioReceive.available()) {
+                if(realtime().enabled) {
+                    realtime().sleepUs(RT_RECEIVER, RT_RECEIVER_POLL_US);
+                }
+                continue;
+            }
+            frameFound = std::chrono::steady_clock::now();
+            draining = true;
+            // the sender of the peer outruns us, when the frames fill the FIFO (the status register of the radio)
+            flowControl().recordFifo(radioReceive.rxFifoFull());
+            uint8_t length = radioReceive.getDynamicPayloadSize();
+            // a length over 32 means a corrupted frame, the library flushes the RX FIFO and tells 0
+            if(length < 1 || length > Geometry::frameSize) {
+                LOG_DEBUG(LOG_RECEIVE, "Dropped a frame with an invalid payload length");
+                continue;
+            }
+            radioReceive.read(&currentMsg, length);
+            // the rest of the last frame must not look like more coalesced acks or a piggybacked trailer
+            memset(currentMsg + length, 0, sizeof(currentMsg) - length);
+            frameCapture().record(CAPTURE_RADIO_RECEIVE, CAPTURE_RX, currentMsg, length);
+            session().heard();
+            // the first byte is the header
+            uint8_t header = currentMsg[0];
+            bool isAck = (header & 0x80) != 0;              // if the most significant bit is 1 -> it is acknowledgement
+
+            LOG_TRACE(LOG_RECEIVE, "Received: most significant bit = {}; second most = {}; seq = {}", header >> 7, (header >> 6) & 1, header & 0x3F);
+
+            // control frame from the other side
+            if(isControlFrame(header)) {
+                handleControl(currentMsg);
+                continue;
+            }
+            // until the session is established, the frames may still belong to the previous run of the peer
+            if(!session().established.load()) {
+                continue;
+            }
+            // acknowledgements riding on the data frame of the peer
+            if(!isAck && txArbiter().piggyback) {
+                uint8_t acks[PIGGYBACK_BITMAP_BITS + 1];
+                uint8_t ackCount = unpackAckTrailer(currentMsg + Geometry::trailerOffset, acks);
+                for(uint8_t i = 0; i < ackCount; ++i) {
+                    handleAck(acks[i]);
+                }
+            }
+            if(isAck) {
+                // the tx arbiter of the peer puts all its pending acknowledgements into one frame, one per byte (most significant bit set)
+                for(int i = 0; i < Geometry::frameSize && (currentMsg[i] & 0x80) != 0; ++i) {
+                    handleAck(currentMsg[i]);
+                }
+                continue;
+            }
+            // if the most significant bit is 0 -> is data fragment, handled as the policy the peer announced says
+            switch(receivePolicy) {
+            case ARQ_POLICY_ACK:
+                receiveFragment<PositiveAck>(currentMsg);
+                break;
+            case ARQ_POLICY_NAK:
+                receiveFragment<NegativeAck>(currentMsg);
+                break;
+            case ARQ_POLICY_BLOCK:
+                receiveFragment<BlockAck>(currentMsg);
+                break;
+            default:
+                LOG_DEBUG(LOG_RECEIVE, "Data fragment before the peer announced its policy, seq = {}", header & 0x3F);
+                break;
+            }
+        }
+    }
+
+    ArqPolicyId policy;     // set before the threads start, hybrid picks the policy per packet
+    HybridPolicy hybrid;
+
+    // variables for some "statistics"
+    int hadToResend;
+    int allSent;
+    uint64_t abortedPackets;    // ip packets the sender gave up on while we were receiving them
+    uint64_t writerDrops;       // complete ip packets dropped, because the tun writer was behind
+    uint64_t abortsUnconfirmed; // aborts of ours the peer never confirmed (it went silent)
+
+private:
+    // tells the receiver to drop what it has of the ip packet, repeated until the receiver confirms it with the
+    // final message (sets packetReceivedOnOtherSide), the pause grows so an unreachable peer is not flooded. The abort
+    // gets the lifetime of the class of the packet once more, and ends when the peer goes silent: the packets behind
+    // it are then dropped as the peer is dead, and a peer that comes back takes the next alternating bit as a new packet.
+    void abortPacket(TrafficClass trafficClass) {
+        uint8_t abortMsg[2];
+        abortMsg[0] = (sendingAltBool ? 0x40 : 0) + CONTROL_SEQ;
+        abortMsg[1] = CONTROL_ABORT;
+        int pauseMs = 1;
+        std::chrono::steady_clock::time_point giveUp = std::chrono::steady_clock::now()
+                                                     + std::chrono::milliseconds(trafficPolicy().limits[trafficClass].lifetimeMs);
+        // a restart of the peer (session reset) frees its state as well
+        while(!packetReceivedOnOtherSide && !session().resetRequested.load()) {
+            if(!session().peerAlive() || std::chrono::steady_clock::now() > giveUp) {
+                ++abortsUnconfirmed;
+                LOG_INFO(LOG_SEND, "Gave up the abort of an ip packet of class {}, the peer did not confirm it ({} = silent), unconfirmed so far: {}",
+                         trafficClass, !session().peerAlive(), abortsUnconfirmed);
+                return;
+            }
+            txArbiter().send(TX_PRIORITY_CONTROL, abortMsg, 2);
+            std::this_thread::sleep_for(std::chrono::milliseconds(pauseMs));
+            if(pauseMs < 64) {
+                pauseMs *= 2;
+            }
+        }
+    }
+
+    // tells the receiver of the peer the policy of the next packets, repeated until it confirms it, false when the
+    // packet ran out of time first (or the peer restarted / went silent)
+    bool announcePolicy(ArqPolicyId packetPolicy, TrafficClass trafficClass, std::chrono::steady_clock::time_point packetStart, bool& expired) {
+        uint8_t policyMsg[3];
+        policyMsg[0] = (sendingAltBool ? 0x40 : 0) + CONTROL_SEQ;
+        policyMsg[1] = CONTROL_POLICY;
+        policyMsg[2] = packetPolicy;
+        confirmedPolicy.store(ARQ_POLICY_NONE);
+        int pauseMs = 1;
+        while(confirmedPolicy.load() != packetPolicy) {
+            if(session().resetRequested.load() || trafficPolicy().exhausted(trafficClass, packetStart, 0, expired) || !session().peerAlive()) {
+                return false;
+            }
+            txArbiter().send(TX_PRIORITY_CONTROL, policyMsg, 3);
+            std::this_thread::sleep_for(std::chrono::milliseconds(pauseMs));
+            if(pauseMs < 64) {
+                pauseMs *= 2;
+            }
+        }
+        announcedPolicy = packetPolicy;
+        LOG_DEBUG(LOG_SEND, "The peer confirmed the policy {} (0 = ack, 1 = nak, 2 = block)", packetPolicy);
+        return true;
+    }
+
+    // puts the sending state back to the start of a session (the restarted peer expects true alternating bit and
+    // knows no policy of ours)
+    void resetSendingState() {
+        sendingAltBool = true;
+        packetReceivedOnOtherSide = false;
+        announcedPolicy = ARQ_POLICY_NONE;
+        flowControl().reset();
+        txPacer().reset();
+        for(int i = 0; i < 64 ; ++i) {
+            fragmentAcks[i] = 0;
+        }
+    }
+
+    // true when the peer has the whole packet: every fragment acknowledged, or the final message
+    template <typename Policy>
+    bool delivered(uint8_t fragmentsToSend) const {
+        if(Policy::finalMessage) {
+            return packetReceivedOnOtherSide;
+        }
+        for(int seq = 1; seq <= fragmentsToSend; ++seq) {
+            if(fragmentAcks[seq] != 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // sends the fragments of the packet and resends them until the peer has all of them, returns true when the packet
+    // is abandoned (too old, out of resend rounds or the peer went silent)
+    template <typename Policy>
+    bool sendFragments(PacketBuffer* packet, uint8_t fragmentsToSend, TrafficClass trafficClass, std::chrono::steady_clock::time_point packetStart,
+                       int& resendRounds, bool& expired) {
+        corruptReported.store(false);
+        for(uint8_t seq = 1; seq <= fragmentsToSend; ++seq) {
+
+            LOG_TRACE(LOG_SEND, "Sending fragment with seq = {}", seq);
+
+            if(!txArbiter().sendShared(TX_PRIORITY_DATA, packetFrame<Geometry>(packet, seq), packet->frameLengths[seq-1], packet->references)) {
+                LOG_WARN(LOG_SEND, "Failed to send part of the ip packet (fragment) with seq = {}", seq);
+            }
+        }
+        while (true) {
+            int answersBefore = blockAcks.load(std::memory_order_acquire);
+            // we poll the receiver after the data, so it sends the naks / the bitmap still needed (also for the last
+            // fragments, whose loss it can't tell otherwise)
+            if(Policy::polled && !delivered<Policy>(fragmentsToSend)) {
+                txArbiter().flushData();     // the poll goes on air after the fragments
+                uint8_t pollMsg[3];
+                pollMsg[0] = (sendingAltBool ? 0x40 : 0) + CONTROL_SEQ;
+                pollMsg[1] = CONTROL_POLL;
+                pollMsg[2] = fragmentsToSend;
+                txArbiter().send(TX_PRIORITY_CONTROL, pollMsg, 3);
+                LOG_DEBUG(LOG_SEND, "Polled the receiver for the fragments it still needs.");
+            }
+            // lets wait for one millisecond, to catch up on acknowledgements ... the time could be tweaked (1ms worked pretty well in my ping tests)
+            txArbiter().flushData();     // the wait starts once the frames are on air
+            realtime().sleepUs(RT_SENDER, 1000);
+            if(delivered<Policy>(fragmentsToSend)) {
+                return false;
+            }
+            // the peer restarted, it knows nothing about this packet anymore
+            if(session().resetRequested.load()) {
+                return false;
+            }
+            // if the packet is too old or out of resend rounds (or the peer went silent), we give up on it, so it does not block the link
+            if(trafficPolicy().exhausted(trafficClass, packetStart, resendRounds, expired) || !session().peerAlive()) {
+                return true;
+            }
+            ++resendRounds;
+            // the peer had the whole packet with a wrong crc and dropped it, we confirm and send every fragment again (the
+            // acks it sent before are all in by now, they left before its report and we waited a millisecond since)
+            bool corrupt = corruptReported.exchange(false, std::memory_order_acquire);
+            if(corrupt) {
+                uint8_t confirmMsg[2];
+                confirmMsg[0] = (sendingAltBool ? 0x40 : 0) + CONTROL_SEQ;
+                confirmMsg[1] = CONTROL_CORRUPT_ACK;
+                txArbiter().send(TX_PRIORITY_CONTROL, confirmMsg, 2);
+                for(int seq = 1; seq <= fragmentsToSend; ++seq) {
+                    fragmentAcks[seq] = Policy::nakGaps ? 1 : 0;
+                }
+                LOG_INFO(LOG_SEND, "The peer got the ip packet with a wrong crc, sending its {} fragments again", fragmentsToSend);
+            }
+            // without an answer to the poll the block sender does not know what is missing, it only polls again
+            if(Policy::blockAck && !corrupt && blockAcks.load(std::memory_order_acquire) == answersBefore) {
+                continue;
+            }
+            // we check all the data fragments, with naks the array tells the ones asked for, otherwise the ones acknowledged
+            for(int seq = 1; seq <= fragmentsToSend; ++seq) {
+                if(Policy::nakGaps ? fragmentAcks[seq] == 1 : fragmentAcks[seq] != 1) {
+
+                    LOG_DEBUG(LOG_SEND, "Had to resend fragment with seq: {}", seq);
+                    if(Policy::nakGaps) {
+                        fragmentAcks[seq] = 0;
+                    }
+                    if(!txArbiter().sendShared(TX_PRIORITY_DATA, packetFrame<Geometry>(packet, seq), packet->frameLengths[seq-1], packet->references)) {
+                        LOG_WARN(LOG_SEND, "Failed to resend part of the ip packet (fragment) with seq = {}", seq);
+                    }
+                    ++hadToResend;
+                }
+            }
+        }
+    }
+
+    // drops everything we have of the ip packet being received (the buffer is not cleared, only the bytes up to the
+    // size of the next packet are written to tun0 and all of them come from its fragments)
+    void resetReassembly() {
+        sizeKnown = false;
+        fragmentsReceived = 0;
+        fragmentsToReceive = 0; // these two (toReceive and packetSize) may not need a reset, but it is good for debugging purposes
+        currentPacketSize = 0;
+        corruptPending = false;
+        for (int i = 0; i < 64; ++i) {
+            fragmentStatus[i] = 0;
+        }
+    }
+
+    // an acknowledgement of the data we sent, from an acknowledgement frame or the trailer of a data frame (--piggyback)
+    void handleAck(uint8_t ack) {
+        bool ackAltBool = (ack & 0x40) != 0;
+        uint8_t ackSeq = ack & 0x3F;
+        // this may happen, when the acknowledgement was sent multiple times ... we moved on after the first one
+        if(ackAltBool != sendingAltBool) {
+
+            LOG_DEBUG(LOG_RECEIVE, "Received acknowledgement to previous (old) ip packet, seq = {}", ackSeq);
+
+        } else if(ackSeq == CONTROL_SEQ) {
+            // means that the other side has the whole packet (final message) or dropped it (abort confirmed)
+            packetReceivedOnOtherSide = true;
+        } else {
+            fragmentAcks[ackSeq] = 1;   // an ack (ack policy) or a request to resend (nak policy) of the fragment with this seq
+        }
+    }
+
+    void sendAck(uint8_t ack) {
+        LOG_TRACE(LOG_RECEIVE, "Sending: most significant bit = {}; second most = {}; seq = {}", ack >> 7, (ack >> 6) & 1, ack & 0x3F);
+        txArbiter().send(TX_PRIORITY_ACK, &ack, 1);
+    }
+
+    // the ip packet with the alternating bit is concluded on our side
+    void sendFinal(bool altBool) {
+        sendAck(altBool ? 0xff : 0xbf);     // b11111111 : b10111111
+    }
+
+    // the acknowledgement of a data fragment (positive acks), while the packet waits to be sent again after a wrong crc
+    // the sender is reminded of that instead
+    void acknowledge(uint8_t header) {
+        if(corruptPending) {
+            uint8_t corruptMsg[2];
+            corruptMsg[0] = (receivingAltBool ? 0x40 : 0) + CONTROL_SEQ;
+            corruptMsg[1] = CONTROL_CORRUPT;
+            txArbiter().send(TX_PRIORITY_CONTROL, corruptMsg, 2);
+        } else {
+            sendAck(header | 0x80);
+        }
+    }
+
+    // asks the sender to resend the fragment
+    void sendNak(uint8_t seq) {
+        uint8_t negAck = receivingAltBool ? 0xc0 : 0x80;    // b11000000 : b10000000
+        negAck += seq;                                      // here we add the sequence number (right 6 bits)
+        fragmentStatus[seq] = 2;                            // we set, that the negAck has been sent
+        sendAck(negAck);
+    }
+
+    // a data fragment of the peer, the policy is the one it announced
+    template <typename Policy>
+    void receiveFragment(const uint8_t* frame) {
+        uint8_t header = frame[0];
+        // second most significant bit is the alternating bit between ip packets, all fragments of the packet share same bit
+        bool receivedAltBool = (header & 0x40) != 0;
+        uint8_t seq = header & 0x3F;
+        // if received data fragment belongs to the previous ip packet -> its ack or the final message was lost, we send
+        // it again, but we dont save the data again
+        if (receivedAltBool != receivingAltBool) {
+            if(Policy::ackEveryFragment) {
+                sendAck(header | 0x80);
+            } else {
+                sendFinal(receivedAltBool);
+            }
+            LOG_DEBUG(LOG_RECEIVE, "Data fragment belongs to previous ip packet, seq = {}", seq);
+            return;
+        }
+        // seq == 0 was the start message of wire format v1, a peer still sending it is reported by the session, a seq
+        // over the fragments of the geometry (a peer with larger frames) would not fit into the buffer
+        if(seq == 0 || seq > Geometry::maxFragments) {
+            return;
+        }
+        // fragment 1 starts with the ip header, its total length tells how many fragments the packet has (its crc
+        // follows it)
+        if(seq == 1 && fragmentStatus[seq] != 1) {
+            uint16_t size;
+            if(!packetSizeOf(frame + Geometry::headerSize, Geometry::maxPacket - CRC32C_SIZE, size)) {
+                // the header is corrupted, without an ack the sender resends it, with naks we ask for it right away
+                if(Policy::nakGaps) {
+                    sendNak(seq);
+                }
+                LOG_WARN(LOG_RECEIVE, "The ip header in fragment 1 was corrupted: bytes = {}", size);
+                return;
+            }
+            if(!sizeKnown) {
+                sizeKnown = true;
+                currentPacketSize = size;
+                fragmentsToReceive = static_cast<uint8_t>((size + CRC32C_SIZE + Geometry::payload - 1) / Geometry::payload);
+            }
+        }
+        // we check if the fragment with this sequence number has already been received
+        if(fragmentStatus[seq] == 1) {
+            // a resend crossed our ack (it is acknowledged again) / one of several naks for it
+            if(Policy::ackEveryFragment) {
+                acknowledge(header);
+            }
+            LOG_DEBUG(LOG_RECEIVE, "Received data fragment, which have already been received, seq = {}", seq);
+            return;
+        }
+        LOG_TRACE(LOG_RECEIVE, "The received message is a new data fragment, seq = {}", seq);
+        fragmentStatus[seq] = 1;
+        if(Policy::nakGaps) {
+            // we check if any previous fragments have not been received yet -> neg-ack = request to resend it
+            for(uint8_t i = 1; i < seq; ++i) {
+                if(fragmentStatus[i] == 0) {
+                    sendNak(i);
+                }
+            }
+        }
+        // we save the data, increment the number of fragments received
+        memcpy(buffer + (seq-1)*Geometry::payload, frame + Geometry::headerSize, Geometry::payload);
+        ++fragmentsReceived;
+        // if we know the size from fragment 1 and if we got all the fragments needed
+        bool complete = sizeKnown && fragmentsReceived == fragmentsToReceive;
+        // with positive acks the fragment completing the packet is acknowledged only once the crc is right (below)
+        if(Policy::ackEveryFragment && !complete) {
+            acknowledge(header);
+        }
+        if(complete) {
+
+            // first we have to check if all the received messages were from the range we want
+            uint8_t corruptedSeqs = 0;
+            for(int i = 1; i <= fragmentsToReceive; ++i) {
+                if(fragmentStatus[i] != 1) {
+                    ++corruptedSeqs;
+                }
+            }
+            // if there are any corrupted seqs, we can't count them as ones from the toReceive group ... we have to listen for more
+            if(corruptedSeqs != 0) {
+                fragmentsReceived -= corruptedSeqs;
+                if(Policy::ackEveryFragment) {
+                    acknowledge(header);
+                }
+
+                LOG_WARN(LOG_RECEIVE, "There were {} fragments with corrupted sequence number.", corruptedSeqs);
+
+                return;
+            }
+            // the crc behind the packet catches what the crc of the radio missed, the fragments are all dropped and
+            // received again (positive acks: the sender learns of it from CONTROL_CORRUPT, naks / bitmaps ask for them)
+            if(!checkCrc32c(buffer, currentPacketSize)) {
+                ++crcFailures;
+                LOG_WARN(LOG_RECEIVE, "The crc of the received ip packet of {} bytes was wrong, wrong so far: {}", currentPacketSize, crcFailures);
+                resetReassembly();
+                if(Policy::ackEveryFragment) {
+                    corruptPending = true;
+                    acknowledge(header);
+                }
+                return;
+            }
+            if(Policy::ackEveryFragment) {
+                sendAck(header | 0x80);
+            }
+            // we tell the other side, that it has the whole packet (with positive acks it knows from them)
+            if(Policy::finalMessage) {
+                sendFinal(receivingAltBool);
+            }
+            receivingAltBool = !receivingAltBool;
+            LOG_DEBUG(LOG_RECEIVE, "Received last fragment, changing receivingAltBool from: {}; to: {}", !receivingAltBool, receivingAltBool);
+
+            // the tun writer checks the ip packet and writes it to the interface, we go back to the radio right away
+            PacketBuffer* next = incoming.freeBuffers.tryPop();
+            if(next != NULL) {
+                assembling->length = currentPacketSize;
+                incoming.packets.push(assembling);
+                assembling = next;
+                buffer = assembling->data;
+            } else {
+                // no free buffer, we don't wait for the writer (the radio fifo would overflow), the packet is lost
+                ++writerDrops;
+                incoming.dropped.fetch_add(1, std::memory_order_relaxed);
+                LOG_WARN(LOG_RECEIVE, "Tun writer behind, dropped received ip packet of {} bytes, dropped so far: {}", currentPacketSize, writerDrops);
+            }
+            // then we reset all the variables
+            resetReassembly();
+        }
+        // if fragment 1 has not been received, or we don't have all the fragments, we just wait for them
+    }
+
+    // the sender asks for the fragments still needed, it tells the fragments in case fragment 1 is missing
+    template <typename Policy>
+    void answerPoll(const uint8_t* frame) {
+        uint8_t fragments = sizeKnown ? fragmentsToReceive : frame[2];
+        if(Policy::nakGaps) {
+            for(uint8_t i = 1; i <= fragments && i <= Geometry::maxFragments; ++i) {
+                if(fragmentStatus[i] != 1) {
+                    sendNak(i);
+                }
+            }
+        }
+        if(Policy::blockAck) {
+            uint8_t blockAck[CONTROL_BLOCK_ACK_SIZE] = {0};
+            blockAck[0] = (receivingAltBool ? 0x40 : 0) + CONTROL_SEQ;
+            blockAck[1] = CONTROL_BLOCK_ACK;
+            for(uint8_t i = 1; i <= fragments && i <= Geometry::maxFragments; ++i) {
+                if(fragmentStatus[i] == 1) {
+                    blockAck[2 + i / 8] |= 1 << (i % 8);
+                }
+            }
+            txArbiter().send(TX_PRIORITY_CONTROL, blockAck, CONTROL_BLOCK_ACK_SIZE);
+        }
+    }
+
+    // a control frame of the other side: from its sender (abort, poll, policy, session) or its receiver (policy
+    // confirmation, bitmap)
+    void handleControl(const uint8_t* frame) {
+        bool receivedAltBool = (frame[0] & 0x40) != 0;
+        if(frame[1] == CONTROL_ABORT) {
+            // the sender gave up on the ip packet we are receiving -> we drop what we have of it and move to the next one
+            if(receivedAltBool == receivingAltBool) {
+                ++abortedPackets;
+                LOG_INFO(LOG_RECEIVE, "Sender aborted the ip packet, {} of {} fragments received, aborted so far: {}", fragmentsReceived, fragmentsToReceive, abortedPackets);
+                receivingAltBool = !receivingAltBool;
+                resetReassembly();
+            }
+            // confirm it with the final message (also for repeated aborts, in case the confirmation was lost)
+            sendFinal(receivedAltBool);
+        } else if(frame[1] == CONTROL_POLL) {
+            if(receivedAltBool != receivingAltBool) {
+                // we have the whole ip packet already, the final message must have been lost
+                sendFinal(receivedAltBool);
+            } else if(receivePolicy == ARQ_POLICY_NAK) {
+                answerPoll<NegativeAck>(frame);
+            } else if(receivePolicy == ARQ_POLICY_BLOCK) {
+                answerPoll<BlockAck>(frame);
+            }
+        } else if(frame[1] == CONTROL_POLICY) {
+            // the policy applies from the next ip packet of the peer on, it is confirmed also when repeated
+            if(frame[2] <= ARQ_POLICY_BLOCK) {
+                if(frame[2] != receivePolicy) {
+                    LOG_INFO(LOG_RECEIVE, "The peer sends with the policy {} (0 = ack, 1 = nak, 2 = block)", frame[2]);
+                }
+                receivePolicy = frame[2];
+                uint8_t confirmMsg[3] = {CONTROL_SEQ, CONTROL_POLICY_ACK, frame[2]};
+                txArbiter().send(TX_PRIORITY_CONTROL, confirmMsg, 3);
+            }
+        } else if(frame[1] == CONTROL_POLICY_ACK) {
+            confirmedPolicy.store(frame[2]);
+        } else if(frame[1] == CONTROL_CORRUPT) {
+            // the peer dropped our packet for its crc, the sender sends it again
+            if(receivedAltBool == sendingAltBool) {
+                corruptReported.store(true, std::memory_order_release);
+            }
+        } else if(frame[1] == CONTROL_CORRUPT_ACK) {
+            // the sender of the peer sends every fragment again, we acknowledge them from now on
+            if(receivedAltBool == receivingAltBool) {
+                corruptPending = false;
+            }
+        } else if(frame[1] == CONTROL_DATAGRAM) {
+            // a fragment of a packet of the fast path, nothing is acknowledged (see fastPath.h)
+            if(session().established.load()) {
+                fastPathLink<Geometry>().receive(frame, incoming);
+            }
+        } else if(frame[1] == CONTROL_CREDIT) {
+            // what the receiver of the peer can take, our sender and the tx arbiter keep to it
+            flowControl().onCredit(frame);
+        } else if(frame[1] == CONTROL_BLOCK_ACK) {
+            // the fragments of our packet the peer has, the sender resends the others (also those it had, when it
+            // dropped the packet for a wrong crc)
+            if(receivedAltBool == sendingAltBool) {
+                for(int seq = 1; seq <= Geometry::maxFragments; ++seq) {
+                    fragmentAcks[seq] = (frame[2 + seq / 8] >> (seq % 8)) & 1;
+                }
+                blockAcks.fetch_add(1, std::memory_order_release);
+            }
+        } else {
+            uint8_t reply;
+            if(session().onControlFrame(frame, reply)) {
+                // the peer restarted -> it starts with true alternating bits and knows nothing about our packets
+                receivingAltBool = true;
+                resetReassembly();
+                fastPathLink<Geometry>().reset();
+                session().requestSenderReset([this]() { resetSendingState(); });
+            }
+            // the hello is answered only after our sender is reset, until then the peer keeps repeating it
+            if(reply != 0 && !session().resetRequested.load()) {
+                session().sendControl(reply);
+            }
+        }
+    }
+
+    PacketPipe& outgoing;
+    PacketPipe& incoming;
+
+    // ---- sending state, the receiver thread records what the peer acknowledged ----
+    // list containing info, if an acknowledgement (or a neg-ack with the nak policy) for the fragment has been received
+    int fragmentAcks[64];           // size 64 is enough, as interface mtu is 1500 and 64*31 >> 1500
+    bool sendingAltBool;
+    bool packetReceivedOnOtherSide;
+    std::atomic<int> blockAcks;         // bitmaps received (block policy)
+    std::atomic<int> confirmedPolicy;   // the policy the receiver of the peer confirmed last
+    int announcedPolicy;                // the policy our packets are sent with, ARQ_POLICY_NONE until confirmed
+    std::atomic<bool> corruptReported;  // the peer got the packet with a wrong crc (CONTROL_CORRUPT)
+    int crcFailures;                    // received packets whose crc was wrong
+
+    // ---- receiving state ----
+    PacketBuffer* assembling;
+    uint8_t* buffer;
+    bool sizeKnown;                     // bool, which tells if we've received fragment 1 (its ip header) of the ip packet
+    uint8_t fragmentsReceived;          // current number of fragments received
+    uint8_t fragmentsToReceive;         // from the ip header in fragment 1, telling us how many data fragments will be received
+    uint16_t currentPacketSize;         // total length from the ip header in fragment 1, telling us how large is the ip packet (in bytes)
+    uint8_t fragmentStatus[64];         // array where we store info about fragment status, 0=unknown/1=received/2=neg-Ack sent
+    bool receivingAltBool;              // bool for the alternating bit in our headers (to sync with other station...)
+    uint8_t receivePolicy;              // the policy the sender of the peer announced
+    bool corruptPending;                // the packet failed its crc, until the sender confirms we answer CONTROL_CORRUPT
+};
+
+// the real-time packets take the fast path with --fast-path, the tun reader sends them itself
+template <typename Geometry>
+bool bypassArq(PacketBuffer* packet) {
+    return fastPath().enabled && packet->trafficClass == CLASS_REALTIME && fastPathLink<Geometry>().send(packet);
+}
+
+// the sender and the receiver thread of the core for the frame geometry, and the fast path of the tun reader. The tx
+// arbiter and the mtu take the frames and the fragments of the same geometry, false if the mtu could not be set.
+template <typename Geometry, typename Radio>
+bool startArqCore(const char* ifname, bool baseStation, PacketPipe& outgoing, PacketPipe& incoming, Radio& radioReceive, ArqPolicyId policy,
+                  std::thread& sender, std::thread& receiver, PacketBypass& bypass) {
+    txArbiter().frameSize = Geometry::frameSize;
+    // mtu of whole fragments, the base station clamps the tcp mss to it
+    if(!linkMtu().start(ifname, baseStation, Geometry::payload)) {
+        return false;
+    }
+    bypass = bypassArq<Geometry>;
+    // lives as long as the program, the radio threads never return
+    ArqCore<Geometry>* core = new ArqCore<Geometry>(outgoing, incoming, policy);
+    sender = std::thread(&ArqCore<Geometry>::sendData, core);
+    receiver = std::thread(&ArqCore<Geometry>::template receiveData<Radio>, core, std::ref(radioReceive));
+    return true;
+}
+
+// the check of the tun writer, with --psk the packet is opened first (forged, corrupted and replayed ones are dropped)
+inline bool openReceivedPacket(PacketBuffer* packet) {
+    if(linkCrypto().enabled && !linkCrypto().open(packet->data, packet->length, session().localEpoch, session().peerEpoch.load())) {
+        return false;
+    }
+    return process_received_packet(packet->data, packet->length);
+}
+
+// the sender, the receiver and the transmit arbiter thread for the frame size of the link (and its mtu on the
+// interface), false if the mtu could not be set
+template <int FrameSize, typename Radio>
+bool startLink(const char* ifname, bool baseStation, Radio& radioSend, Radio& radioReceive, PacketPipe& outgoing, PacketPipe& incoming,
+               ArqPolicyId policy, std::thread& sender, std::thread& receiver, std::thread& transmitter, PacketBypass& bypass) {
+    // with --piggyback the acknowledgement trailer takes the end of every frame
+    bool started;
+    if(txArbiter().piggyback) {
+        started = startArqCore<typename LinkFrames<FrameSize>::Piggyback>(ifname, baseStation, outgoing, incoming, radioReceive, policy, sender, receiver, bypass);
+    } else {
+        started = startArqCore<typename LinkFrames<FrameSize>::Plain>(ifname, baseStation, outgoing, incoming, radioReceive, policy, sender, receiver, bypass);
+    }
+    if(!started) {
+        return false;
+    }
+    // the only thread writing to the send radio, the sender and the receiver queue their frames for it
+    transmitter = std::thread([&radioSend]() {
+        realtime().enter(RT_TRANSMITTER);
+        txArbiter().run(radioSend);
+    });
+    return true;
+}
+
+// SIGUSR1 handler, switches the frame capture on/off
+inline void toggleCapture(int) {
+    frameCapture().setEnabled(!frameCapture().isEnabled());
+}
+
+// the whole program, defaultPolicy is the one used without --arq
+inline int arqMain(int argc, char** argv, ArqPolicyId defaultPolicy) {
+    // setup radios -----------------------------------------------------------------------------------------
+    bool baseStation; // 0 uses address[0] (BAS) to transmit/write, 1 uses address[1] (MOB) to transmit/write
+     // Check if at least one command-line argument is provided
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " [--mobile | --base] [--arq ack | nak | block | hybrid] [--capture file.pcap] [--log level | module=level,...] [--log-file file] [--class-limits class=ms/rounds,...] [--realtime-ports ports] [--fast-path] [--dead-peer-ms ms] [--takeover] [--cpus reader,sender,receiver,writer] [--piggyback] [--piggyback-us us] [--no-ack-filter] [--no-flow-control] [--tx-gap-us us] [--tx-gap-fixed] [--pep] [--pep-port port] [--pep-cc algorithm] [--mtu bytes] [--no-io-uring] [--tun-queues] [--udp-link port,address:port] [--psk keyfile] [--rt] [--rt-priorities transmitter,receiver,sender]" << std::endl;
+        std::cerr << "       " << argv[0] << " --crypto-bench" << std::endl;
+        return 1; // Return error code
+    }
+    // Convert the command-line argument to a std::string for easier comparison
+    std::string arg = argv[1];
+    if(arg == "--crypto-bench") {
+        // how fast the packets are sealed and opened on this machine (see linkCrypto.h)
+        return linkCryptoBenchmark();
+    }
+    // Check which argument was passed
+    if (arg == "--mobile") {
+        baseStation = false;
+    } else if (arg == "--base") {
+        baseStation = true;
+    } else {
+        std::cerr << "Invalid argument: " << arg << "; should be: [--mobile | --base]" << std::endl;
+        return 1;
+    }
+    // optional arguments after the station type
+    const char* capturePath = NULL;
+    const char* logPath = NULL;
+    bool takeover = false;
+    bool pep = false;
+    ArqPolicyId policy = defaultPolicy;
+    int cpus[STAGE_COUNT] = {-1, -1, -1, -1};
+    for(int i = 2; i < argc; ++i) {
+        std::string option = argv[i];
+        if(option == "--capture" && i + 1 < argc) {
+            capturePath = argv[++i];
+        } else if(option == "--arq" && i + 1 < argc) {
+            // acknowledgement policy of the packets we send (see arqPolicy.h), the peer may use another one
+            std::string name = argv[++i];
+            if(name == "ack") {
+                policy = ARQ_POLICY_ACK;
+            } else if(name == "nak") {
+                policy = ARQ_POLICY_NAK;
+            } else if(name == "block") {
+                policy = ARQ_POLICY_BLOCK;
+            } else if(name == "hybrid") {
+                policy = ARQ_POLICY_HYBRID;
+            } else {
+                std::cerr << "Invalid policy: " << name << "; should be: ack, nak, block or hybrid" << std::endl;
+                return 1;
+            }
+        } else if(option == "--log" && i + 1 < argc) {
+            // levels: error, warn, info, debug, trace; modules: main, send, receive
+            if(!asyncLog().configure(argv[++i])) {
+                std::cerr << "Invalid log levels: " << argv[i] << "; should be like: debug or send=debug,receive=trace" << std::endl;
+                return 1;
+            }
+        } else if(option == "--cpus" && i + 1 < argc) {
+            // cpu of the tun reader, sender, receiver and tun writer threads (-1 = not pinned), e.g. 0,1,2,3
+            if(!parseCpuList(argv[++i], cpus)) {
+                std::cerr << "Invalid cpu list: " << argv[i] << "; should be like: 0,1,2,3" << std::endl;
+                return 1;
+            }
+        } else if(option == "--piggyback") {
+            // acknowledgements in the trailer of the data frames going the other way (the other station must use it too)
+            txArbiter().piggyback = true;
+            session().features |= SESSION_FEATURE_PIGGYBACK;
+        } else if(option == "--piggyback-us" && i + 1 < argc) {
+            // how long acknowledgements wait for a data frame before they are sent on their own
+            txArbiter().piggybackUs = atoi(argv[++i]);
+            if(txArbiter().piggybackUs < 0) {
+                std::cerr << "Invalid piggyback time: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if(option == "--no-ack-filter") {
+            // send every tcp ack, also those a newer one queued behind makes redundant
+            ackFilter().enabled = false;
+        } else if(option == "--no-flow-control") {
+            // neither advertise our credits nor keep to those of the peer (see flowControl.h)
+            flowControl().enabled = false;
+        } else if(option == "--tx-gap-us" && i + 1 < argc) {
+            // the least gap between two data frames, the pacer widens it when the peer can't keep up (see txPacer.h)
+            txPacer().gapUs = atoi(argv[++i]);
+            if(txPacer().gapUs < 0 || txPacer().gapUs > TX_PACER_MAX_US) {
+                std::cerr << "Invalid gap: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if(option == "--tx-gap-fixed") {
+            // the gap stays as --tx-gap-us sets it
+            txPacer().adaptive = false;
+        } else if(option == "--pep") {
+            // terminate the tcp connections crossing tun0 and relay them (split tcp, see tcpProxy.h)
+            pep = true;
+        } else if(option == "--pep-port" && i + 1 < argc) {
+            int port = atoi(argv[++i]);
+            if(port <= 0 || port > 65535) {
+                std::cerr << "Invalid proxy port: " << argv[i] << std::endl;
+                return 1;
+            }
+            tcpProxy().port = static_cast<uint16_t>(port);
+        } else if(option == "--pep-cc" && i + 1 < argc) {
+            // congestion control of the link side connections of the proxy
+            tcpProxy().congestionControl = argv[++i];
+        } else if(option == "--mtu" && i + 1 < argc) {
+            // a fixed mtu of tun0 instead of the one adapted to the loss (see linkMtu.h)
+            linkMtu().fixedMtu = atoi(argv[++i]);
+            if(linkMtu().fixedMtu < LINK_MTU_MIN || linkMtu().fixedMtu > LINK_MTU_MAX) {
+                std::cerr << "Invalid mtu: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if(option == "--no-io-uring") {
+            // read and write tun0 with a system call per packet (see tunRing.h)
+            tunRing().enabled = false;
+        } else if(option == "--tun-queues") {
+            // multi queue tun0, the tun writer gets a queue of its own
+            tunRing().multiQueue = true;
+        } else if(option == "--udp-link" && i + 1 < argc) {
+            // no radios, the frames go over udp to the other station (see udpLink.h)
+            if(!udpLink().configure(argv[++i])) {
+                std::cerr << "Invalid udp link: " << argv[i] << "; should be like: 7000,192.168.1.20:7000" << std::endl;
+                return 1;
+            }
+        } else if(option == "--psk" && i + 1 < argc) {
+            // seal the ip packets with the pre-shared key in the file (the other station must use the same key)
+            if(!linkCrypto().loadKey(argv[++i])) {
+                return 1;
+            }
+            if(!chachaPolySelfTest()) {
+                std::cerr << "ChaCha20-Poly1305 (" << CHACHA_SIMD << ") fails its test vector" << std::endl;
+                return 1;
+            }
+            session().features |= SESSION_FEATURE_SEALED;
+            linkMtu().overhead += LINK_CRYPTO_OVERHEAD;
+        } else if(option == "--rt") {
+            // the radio threads under SCHED_FIFO and the memory locked (see realtime.h), best with --cpus
+            realtime().enabled = true;
+        } else if(option == "--rt-priorities" && i + 1 < argc) {
+            // SCHED_FIFO priorities of the tx arbiter, the receiver and the sender, e.g. 50,49,48 (implies --rt)
+            if(!realtime().parsePriorities(argv[++i])) {
+                std::cerr << "Invalid priorities: " << argv[i] << "; should be like: 50,49,48 (the transmitter above the sender)" << std::endl;
+                return 1;
+            }
+            realtime().enabled = true;
+        } else if(option == "--takeover") {
+            // take tun0 and the state over from the running process (upgrade / reload without breaking connections)
+            takeover = true;
+        } else if(option == "--log-file" && i + 1 < argc) {
+            logPath = argv[++i];
+        } else if(option == "--class-limits" && i + 1 < argc) {
+            // lifetime and resend rounds per traffic class (realtime, tcp, default), e.g. realtime=100/10
+            if(!trafficPolicy().configureLimits(argv[++i])) {
+                std::cerr << "Invalid class limits: " << argv[i] << "; should be like: realtime=100/10,tcp=2000/200" << std::endl;
+                return 1;
+            }
+        } else if(option == "--fast-path") {
+            // the real-time packets go unacknowledged, beside the ARQ instead of through it (see fastPath.h)
+            fastPath().enabled = true;
+        } else if(option == "--dead-peer-ms" && i + 1 < argc) {
+            // how long the peer may be silent before we stop trying to send to it (keepalives are sent 4 times as often)
+            session().deadPeerMs = atoi(argv[++i]);
+            if(session().deadPeerMs < 4) {
+                std::cerr << "Invalid dead peer time: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if(option == "--realtime-ports" && i + 1 < argc) {
+            // udp ports of the real-time traffic, e.g. 5004-5005,27015
+            if(!trafficPolicy().configurePorts(argv[++i])) {
+                std::cerr << "Invalid port list: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Invalid option: " << option << std::endl;
+            return 1;
+        }
+    }
+    // the log lines are written by a background thread, so the radio loops never block on the terminal
+    FILE* logFile = stderr;
+    if(logPath != NULL) {
+        logFile = fopen(logPath, "a");
+        if(logFile == NULL) {
+            perror("Failed to open log file");
+            return 1;
+        }
+    }
+    asyncLog().start(logFile);
+    // capture of all radio frames into a pcap file, SIGUSR1 switches it off and on while running
+    if(capturePath != NULL) {
+        if(!frameCapture().start(capturePath)) {
+            return 1;
+        }
+        signal(SIGUSR1, toggleCapture);
+    }
+
+    // the running process hands over tun0 and exits, only then the radios are ours
+    int tun_fd = -1;
+    bool tookOver = takeover && hotRestart().takeOver(I_FACE, tun_fd);
+
+    RF24 radioSend(RADIO_ONE_CE_PIN, RADIO_ONE_CSN_PIN);
+    RF24 radioReceive(RADIO_TWO_CE_PIN, RADIO_TWO_CSN_PIN);
+
+    if(udpLink().enabled) {
+        if(!udpLink().open()) {
+            return 1;
+        }
+    } else {
+        setupSendRadio(radioSend, baseStation);
+        setupReceiveRadio(radioReceive, baseStation);
+    }
+
+    // setup interface --------------------------------------------------------------------------------------
+    if(!tookOver) {
+        tun_fd = open("/dev/net/tun", O_RDWR);
+        if (tun_fd < 0) {
+            perror("Failed to open TUN device");
+            return 1;
+        }
+        // setting interfac flags
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+        if(tunRing().multiQueue) {
+            ifr.ifr_flags |= IFF_MULTI_QUEUE;
+        }
+        //ifr.ifr_mtu = 1500;                     // set the MTU size to 1500 bytes
+        strncpy(ifr.ifr_name, I_FACE, IFNAMSIZ);
+        // initializing the interface with set flags
+        if (ioctl(tun_fd, TUNSETIFF, (void *)&ifr) < 0) {
+            perror("Failed to ioctl TUNSETIFF"); // Print error message
+            std::cerr << "Error number: " << errno << std::endl; // Print error number
+            close(tun_fd);
+            return 1;
+        }
+        // the interface (with its address and routes) stays when the fd is closed, so it survives a hot restart
+        if (ioctl(tun_fd, TUNSETPERSIST, 1) < 0) {
+            perror("Failed to make TUN persistent");
+            close(tun_fd);
+            return 1;
+        }
+        // setting interface owner
+        int uid = 1000;
+        if (ioctl(tun_fd, TUNSETOWNER, uid) < 0) {
+            perror("Failed to set TUN owner");
+            close(tun_fd);
+            return 1;
+        }
+    }
+    // Assign an IP address to the tun0 interface and bring it up, over netlink (see netConfig.h), replacing what a previous run left behind
+    if(!setAddress(I_FACE, baseStation ? BASE_ADDRESS : MOBILE_ADDRESS, 24) || !setLinkUp(I_FACE, 0)) {
+        std::cerr << "Failed to configure " << I_FACE << std::endl;
+        return 1;
+    }
+    if(baseStation) {   // base station -> forwarding has to be enabled on the system, then we configure nat in our own nftables table
+        if(!setupNat(I_FACE, UPLINK_FACE)) {
+            std::cerr << "Failed to configure the base station." << std::endl;
+            return 1;
+        }
+    } else {            // mobile station -> default gateway, where we send through tun0 device...
+        if(!setDefaultRoute(I_FACE, BASE_ADDRESS, true)) {
+            std::cerr << "Failed to add default route" << std::endl;
+            return 1;
+        }
+    }
+    if(pep && (!setupProxyRedirect(I_FACE, tcpProxy().port, PROXY_MARK, baseStation) || !tcpProxy().start(baseStation))) {
+        std::cerr << "Failed to start the tcp proxy" << std::endl;
+        return 1;
+    }
+    // ------------------------------------------------------------------------------------------------------
+
+    // SIGINT and SIGTERM are blocked in all threads and taken by the main thread below, so it can clean up
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+
+    // with --rt the pipes and the stacks of the threads are faulted in and locked as they are created
+    realtime().lockMemory();
+
+    // the two directions of the pipeline, tun0 -> radio and radio -> tun0 (see pipeline.h)
+    PacketPipe outgoing;
+    PacketPipe incoming;
+    int writerFd = tunRing().writerQueue(I_FACE, tun_fd);
+
+    // Start the pipeline threads, the radio ones (sender and receiver) never wait for tun0
+    std::thread sender;
+    std::thread receiver;
+    std::thread transmitter;
+    // the tun reader frames the packets of the fast path for the same link as the core, the mtu of tun0 is set for its
+    // fragments there too
+    PacketBypass bypass;
+    bool started;
+    if(udpLink().enabled) {
+        started = startLink<UDP_FRAME_SIZE>(I_FACE, baseStation, udpLink(), udpLink(), outgoing, incoming, policy, sender, receiver, transmitter, bypass);
+    } else {
+        started = startLink<RADIO_FRAME_SIZE>(I_FACE, baseStation, radioSend, radioReceive, outgoing, incoming, policy, sender, receiver, transmitter, bypass);
+    }
+    if(!started) {
+        std::cerr << "Failed to set the mtu of " << I_FACE << std::endl;
+        return 1;
+    }
+    std::thread reader(tunRingReader, tun_fd, std::ref(outgoing), process_received_packet, bypass);
+    std::thread writer(tunRingWriter, writerFd, std::ref(incoming), openReceivedPacket);
+    pinThread(reader, cpus[STAGE_TUN_READER]);
+    pinThread(sender, cpus[STAGE_SENDER]);
+    pinThread(transmitter, cpus[STAGE_SENDER]);
+    pinThread(receiver, cpus[STAGE_RECEIVER]);
+    pinThread(writer, cpus[STAGE_TUN_WRITER]);
+
+    // a new process started with --takeover can take over from now on
+    hotRestart().listen(I_FACE, tun_fd);
+
+    // the threads run until we are stopped, then the nat table / route is removed again
+    int stopSignal = 0;
+    sigwait(&stopSignals, &stopSignal);
+    LOG_INFO(LOG_MAIN, "Signal {} received, shutting down", stopSignal);
+    LOG_INFO(LOG_MAIN, "tun0: {} packets read in {} io_uring calls, {} written in {}", tunRing().packetsRead.load(),
+             tunRing().readCalls.load(), tunRing().packetsWritten.load(), tunRing().writeCalls.load());
+    if(udpLink().enabled) {
+        LOG_INFO(LOG_MAIN, "udp link: {} frames sent, {} received, {} from other addresses dropped", udpLink().framesSent.load(),
+                 udpLink().framesReceived.load(), udpLink().framesDropped.load());
+    }
+    if(linkCrypto().enabled) {
+        LOG_INFO(LOG_MAIN, "sealed packets: {} sent, {} received", linkCrypto().sealed.load(), linkCrypto().opened.load());
+        LOG_INFO(LOG_MAIN, "sealed packets dropped: {} failed authentication, {} replayed, {} under an old epoch",
+                 linkCrypto().authFailures.load(), linkCrypto().replays.load(), linkCrypto().refusedEpochs.load());
+    }
+    LOG_INFO(LOG_MAIN, "flow control: {} packets waited for a buffer of the peer, {} data frames paced to its drain time of {} us, {} credits advertised",
+             flowControl().creditStalls.load(), txArbiter().pacedFrames.load(), txArbiter().drainUs(), flowControl().advertisements.load());
+    LOG_INFO(LOG_MAIN, "tx pacing: gap {} us, widened {} times, narrowed {} times, our RX FIFO was full {} times",
+             txArbiter().gapUs(), txPacer().raised.load(), txPacer().lowered.load(), flowControl().rxFifoFull.load());
+    fastPath().logStats();
+    realtime().logStats();
+    if(baseStation || pep) {
+        teardownNat();
+    }
+    if(!baseStation) {
+        setDefaultRoute(I_FACE, BASE_ADDRESS, false);
+    }
+    frameCapture().stop();
+    asyncLog().stop();
+    // stopped on purpose -> tun0 goes away with the fd
+    ioctl(tun_fd, TUNSETPERSIST, 0);
+    close(tun_fd);
+    // the radio threads never return, so they are not joined
+    std::_Exit(0);
+}
+
+#endif
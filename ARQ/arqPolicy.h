@@ -0,0 +1,101 @@
+#ifndef ARQ_POLICY_H
+#define ARQ_POLICY_H
+
+// Acknowledgement policies of the ARQ core (arqCore.h).
+// A policy is a set of compile time constants: the core has a sender and a receiver instantiation for every policy, so
+// their loops carry no checks of the policy. Which instantiation runs is chosen once per ip packet by the sender and
+// once per frame by the receiver, the sender tells the receiver of the peer with CONTROL_POLICY which one it uses.
+// - ack:    every data fragment is acknowledged, after each 1 ms wait the sender resends the ones without an ack
+// - nak:    the receiver asks for the fragments it misses (gaps and a poll after every round of the sender) and sends
+//           the final message when it has the whole packet, a packet sent without loss costs one acknowledgement
+// - block:  the receiver stays silent until polled, then it answers with a bitmap of the fragments it has
+//           (CONTROL_BLOCK_ACK) or with the final message
+// - hybrid: nak while the link is clean, ack once the loss rises (fewer polls and lost naks to wait for), switched
+//           between packets by HybridPolicy
+
+#include <stdint.h>
+#include "asyncLog.h"
+
+// the policies on the wire (the third byte of CONTROL_POLICY), hybrid picks one of the first three per packet
+enum ArqPolicyId {
+    ARQ_POLICY_ACK,
+    ARQ_POLICY_NAK,
+    ARQ_POLICY_BLOCK,
+    ARQ_POLICY_HYBRID
+};
+// no policy announced / confirmed yet
+#define ARQ_POLICY_NONE 0xFF
+
+// the hybrid policy goes to positive acks above this loss and back to naks below the lower one
+#define HYBRID_LOSS_TO_ACK 0.10
+#define HYBRID_LOSS_TO_NAK 0.03
+// frames sent (and resent) before the loss is judged again
+#define HYBRID_MIN_FRAMES 200
+
+struct PositiveAck {
+    static const ArqPolicyId id = ARQ_POLICY_ACK;
+    static const bool ackEveryFragment = true;      // the receiver acknowledges each data fragment
+    static const bool nakGaps = false;              // the receiver asks for the fragments skipped
+    static const bool finalMessage = false;         // the receiver sends the final message for a whole packet
+    static const bool blockAck = false;             // a poll is answered with a bitmap
+    static const bool polled = false;               // the sender polls after every round
+};
+
+struct NegativeAck {
+    static const ArqPolicyId id = ARQ_POLICY_NAK;
+    static const bool ackEveryFragment = false;
+    static const bool nakGaps = true;
+    static const bool finalMessage = true;
+    static const bool blockAck = false;
+    static const bool polled = true;
+};
+
+struct BlockAck {
+    static const ArqPolicyId id = ARQ_POLICY_BLOCK;
+    static const bool ackEveryFragment = false;
+    static const bool nakGaps = false;
+    static const bool finalMessage = true;
+    static const bool blockAck = true;
+    static const bool polled = true;
+};
+
+// picks the policy of the hybrid mode from the loss the sender sees, with hysteresis so it does not flap
+class HybridPolicy {
+public:
+    HybridPolicy() : current(ARQ_POLICY_NAK), switches(0), frames(0), resends(0), loss(0) {}
+
+    // the sender calls this after every packet with the frames it sent the first time and resent, returns the policy
+    // of the next packet
+    ArqPolicyId next(int sent, int resent) {
+        frames += sent + resent;
+        resends += resent;
+        if(frames < HYBRID_MIN_FRAMES) {
+            return current;
+        }
+        loss = 0.5 * loss + 0.5 * static_cast<double>(resends) / frames;
+        frames = 0;
+        resends = 0;
+        ArqPolicyId wanted = current;
+        if(current == ARQ_POLICY_NAK && loss > HYBRID_LOSS_TO_ACK) {
+            wanted = ARQ_POLICY_ACK;
+        } else if(current == ARQ_POLICY_ACK && loss < HYBRID_LOSS_TO_NAK) {
+            wanted = ARQ_POLICY_NAK;
+        }
+        if(wanted != current) {
+            ++switches;
+            LOG_INFO(LOG_SEND, "Loss {} per mille, hybrid policy {} -> {} (0 = ack, 1 = nak)", static_cast<int>(loss * 1000), current, wanted);
+            current = wanted;
+        }
+        return current;
+    }
+
+    ArqPolicyId current;
+    uint64_t switches;
+
+private:
+    int frames;
+    int resends;
+    double loss;
+};
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+// Asynchronous logging for the hot loops.
+// A log statement only stores the (literal) format string and up to LOG_MAX_ARGS integer arguments into a ring
+// owned by the calling thread, a background thread drains all the rings, formats the lines and writes them out.
+// Levels above LOG_COMPILE_LEVEL are removed by the compiler, the remaining ones are filtered per module at runtime.
+//
+// usage: LOG_DEBUG(LOG_SEND, "Sending fragment with seq = {}", seq);
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3       // per ip packet / per fragment events
+#define LOG_LEVEL_TRACE 4       // every radio frame
+
+// levels above this one are compiled out. All are compiled in by default, so the per fragment messages can be switched
+// on in the field (--log send=trace), a disabled one costs the load of its module level; -DLOG_COMPILE_LEVEL=3 drops them
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_TRACE
+#endif
+
+#define LOG_MAX_ARGS 4
+// records per thread (must be a power of two), when full the records are dropped and counted
+#define LOG_RING_SIZE 1024
+
+enum LogModule {
+    LOG_MAIN,
+    LOG_SEND,
+    LOG_RECEIVE,
+    LOG_SESSION,
+    LOG_PROXY,
+    LOG_MODULE_COUNT
+};
+
+static const char* const logModuleNames[LOG_MODULE_COUNT] = {"main", "send", "receive", "session", "proxy"};
+static const char* const logLevelNames[LOG_LEVEL_TRACE + 1] = {"error", "warn", "info", "debug", "trace"};
+
+struct LogRecord {
+    uint64_t timestampNs;
+    const char* format;     // must be a string literal, only the pointer is stored
+    uint8_t level;
+    uint8_t module;
+    uint8_t argCount;
+    int64_t args[LOG_MAX_ARGS];
+};
+
+// single producer (the owning thread), single consumer (the drain thread)
+struct LogRing {
+    LogRing() : head(0), tail(0) {}
+
+    bool push(const LogRecord& record) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h - tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+            return false;
+        }
+        records[h & (LOG_RING_SIZE - 1)] = record;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(LogRecord& record) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        record = records[t & (LOG_RING_SIZE - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    LogRecord records[LOG_RING_SIZE];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
+
+template <typename T>
+inline int64_t logArg(T value) {
+    static_assert(std::is_integral<T>::value || std::is_enum<T>::value, "log arguments must be integers (the format is done later)");
+    return static_cast<int64_t>(value);
+}
+
+class AsyncLog {
+public:
+    AsyncLog() : running(false), out(stderr), dropped(0), startNs(nowNs()) {
+        for(int i = 0; i < LOG_MODULE_COUNT; ++i) {
+            levels[i].store(LOG_LEVEL_INFO);
+        }
+    }
+
+    ~AsyncLog() {
+        stop();
+    }
+
+    // starts the drain thread, the lines are written to the given file
+    void start(FILE* output) {
+        if(running.exchange(true)) {
+            return;
+        }
+        out = output;
+        drainer = std::thread(&AsyncLog::drainLoop, this);
+    }
+
+    void stop() {
+        if(!running.exchange(false)) {
+            return;
+        }
+        drainer.join();
+        drainOnce();
+        if(dropped.load() != 0) {
+            fprintf(out, "log: %llu records dropped (ring full)\n", static_cast<unsigned long long>(dropped.load()));
+        }
+        fflush(out);
+    }
+
+    void setLevel(int module, int level) {
+        levels[module].store(level, std::memory_order_relaxed);
+    }
+
+    int level(int module) const {
+        return levels[module].load(std::memory_order_relaxed);
+    }
+
+    bool enabled(int module, int level) const {
+        return level <= levels[module].load(std::memory_order_relaxed);
+    }
+
+    // parses "debug" (all modules) or "send=debug,receive=trace", returns false if the spec is invalid
+    bool configure(const std::string& spec) {
+        size_t begin = 0;
+        while(begin <= spec.size()) {
+            size_t end = spec.find(',', begin);
+            if(end == std::string::npos) {
+                end = spec.size();
+            }
+            std::string item = spec.substr(begin, end - begin);
+            size_t equals = item.find('=');
+            int lvl = parseLevel(equals == std::string::npos ? item : item.substr(equals + 1));
+            if(lvl < 0) {
+                return false;
+            }
+            if(equals == std::string::npos) {
+                for(int i = 0; i < LOG_MODULE_COUNT; ++i) {
+                    setLevel(i, lvl);
+                }
+            } else {
+                int module = parseModule(item.substr(0, equals));
+                if(module < 0) {
+                    return false;
+                }
+                setLevel(module, lvl);
+            }
+            begin = end + 1;
+        }
+        return true;
+    }
+
+    template <typename... Args>
+    void write(int level, int module, const char* format, Args... args) {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+        int64_t values[] = {0, logArg(args)...};
+        LogRecord record;
+        record.timestampNs = nowNs();
+        record.format = format;
+        record.level = static_cast<uint8_t>(level);
+        record.module = static_cast<uint8_t>(module);
+        record.argCount = static_cast<uint8_t>(sizeof...(Args));
+        for(size_t i = 0; i < sizeof...(Args); ++i) {
+            record.args[i] = values[i + 1];
+        }
+        if(!threadRing().push(record)) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t droppedRecords() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    static uint64_t nowNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+    static int parseLevel(const std::string& name) {
+        for(int i = 0; i <= LOG_LEVEL_TRACE; ++i) {
+            if(name == logLevelNames[i]) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    static int parseModule(const std::string& name) {
+        for(int i = 0; i < LOG_MODULE_COUNT; ++i) {
+            if(name == logModuleNames[i]) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // the ring of the calling thread, created on its first log statement
+    LogRing& threadRing() {
+        static thread_local LogRing* ring = NULL;
+        if(ring == NULL) {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            rings.push_back(std::unique_ptr<LogRing>(new LogRing()));
+            ring = rings.back().get();
+        }
+        return *ring;
+    }
+
+    void format(const LogRecord& record) {
+        char line[512];
+        double seconds = static_cast<double>(record.timestampNs - startNs) / 1e9;
+        int length = snprintf(line, sizeof(line), "[%12.6f] %-5s %s: ", seconds, logLevelNames[record.level], logModuleNames[record.module]);
+        // every {} in the format is replaced with the next argument
+        uint8_t arg = 0;
+        for(const char* c = record.format; *c != '\0' && length < static_cast<int>(sizeof(line)) - 24; ++c) {
+            if(c[0] == '{' && c[1] == '}' && arg < record.argCount) {
+                length += snprintf(line + length, sizeof(line) - length, "%lld", static_cast<long long>(record.args[arg++]));
+                ++c;
+            } else {
+                line[length++] = *c;
+            }
+        }
+        line[length++] = '\n';
+        fwrite(line, 1, length, out);
+    }
+
+    // takes everything out of the rings and writes it ordered by time
+    void drainOnce() {
+        std::vector<LogRing*> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            for(size_t i = 0; i < rings.size(); ++i) {
+                snapshot.push_back(rings[i].get());
+            }
+        }
+        batch.clear();
+        LogRecord record;
+        for(size_t i = 0; i < snapshot.size(); ++i) {
+            while(snapshot[i]->pop(record)) {
+                batch.push_back(record);
+            }
+        }
+        if(batch.empty()) {
+            return;
+        }
+        std::sort(batch.begin(), batch.end(), [](const LogRecord& a, const LogRecord& b) { return a.timestampNs < b.timestampNs; });
+        for(size_t i = 0; i < batch.size(); ++i) {
+            format(batch[i]);
+        }
+        fflush(out);
+    }
+
+    void drainLoop() {
+        while(running.load()) {
+            drainOnce();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    std::atomic<int> levels[LOG_MODULE_COUNT];
+    std::atomic<bool> running;
+    FILE* out;
+    std::thread drainer;
+    std::mutex ringsMutex;
+    std::vector<std::unique_ptr<LogRing> > rings;
+    std::vector<LogRecord> batch;
+    std::atomic<uint64_t> dropped;
+    uint64_t startNs;
+};
+
+// the one log of the program
+inline AsyncLog& asyncLog() {
+    static AsyncLog instance;
+    return instance;
+}
+
+// the level check against LOG_COMPILE_LEVEL is a constant, so disabled levels generate no code at all
+#define ARQ_LOG(level, module, ...) \
+    do { \
+        if((level) <= LOG_COMPILE_LEVEL && asyncLog().enabled((module), (level))) { \
+            asyncLog().write((level), (module), __VA_ARGS__); \
+        } \
+    } while(0)
+
+#define LOG_ERROR(module, ...) ARQ_LOG(LOG_LEVEL_ERROR, module, __VA_ARGS__)
+#define LOG_WARN(module, ...) ARQ_LOG(LOG_LEVEL_WARN, module, __VA_ARGS__)
+#define LOG_INFO(module, ...) ARQ_LOG(LOG_LEVEL_INFO, module, __VA_ARGS__)
+#define LOG_DEBUG(module, ...) ARQ_LOG(LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+#define LOG_TRACE(module, ...) ARQ_LOG(LOG_LEVEL_TRACE, module, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef CHACHA_POLY_H
+#define CHACHA_POLY_H
+
+// ChaCha20-Poly1305 (RFC 8439) for sealing the ip packets on the link (see linkCrypto.h).
+// ChaCha20 runs four blocks at once in the vector registers (SSE2 on x86, NEON on the Raspberry Pi), the end of a
+// packet shorter than four blocks goes through the scalar block function. Poly1305 uses 26 bit limbs, so it needs
+// no 128 bit multiplication (32 bit ARM). Only what the AEAD needs is here: every input of Poly1305 is a whole
+// number of 16 byte blocks (the AEAD pads the associated data and the ciphertext with zeros).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define CHACHA_SIMD "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CHACHA_SIMD "neon"
+#else
+#define CHACHA_SIMD "scalar"
+#endif
+
+#define CHACHA_KEY_SIZE 32
+#define CHACHA_NONCE_SIZE 12
+#define CHACHA_BLOCK_SIZE 64
+#define POLY1305_TAG_SIZE 16
+
+inline uint32_t loadLe32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16)
+           | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline void storeLe32(uint8_t* p, uint32_t value) {
+    p[0] = static_cast<uint8_t>(value);
+    p[1] = static_cast<uint8_t>(value >> 8);
+    p[2] = static_cast<uint8_t>(value >> 16);
+    p[3] = static_cast<uint8_t>(value >> 24);
+}
+
+inline void storeLe64(uint8_t* p, uint64_t value) {
+    storeLe32(p, static_cast<uint32_t>(value));
+    storeLe32(p + 4, static_cast<uint32_t>(value >> 32));
+}
+
+// a key as the words of the state, converted once per session instead of once per packet
+struct ChaChaKey {
+    uint32_t words[8];
+
+    void load(const uint8_t* key) {
+        for(int i = 0; i < 8; ++i) {
+            words[i] = loadLe32(key + 4 * i);
+        }
+    }
+};
+
+inline uint32_t chachaRotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+#define CHACHA_QUARTER(a, b, c, d) \
+    a += b; d ^= a; d = chachaRotl(d, 16); \
+    c += d; b ^= c; b = chachaRotl(b, 12); \
+    a += b; d ^= a; d = chachaRotl(d, 8); \
+    c += d; b ^= c; b = chachaRotl(b, 7);
+
+// the initial state: constants, key, block counter and nonce (words 13 to 15)
+inline void chachaState(uint32_t state[16], const ChaChaKey& key, uint32_t counter, const uint8_t nonce[CHACHA_NONCE_SIZE]) {
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for(int i = 0; i < 8; ++i) {
+        state[4 + i] = key.words[i];
+    }
+    state[12] = counter;
+    for(int i = 0; i < 3; ++i) {
+        state[13 + i] = loadLe32(nonce + 4 * i);
+    }
+}
+
+// the 20 rounds, without adding the input (HChaCha20 takes the state as it is)
+inline void chachaRounds(uint32_t x[16]) {
+    for(int round = 0; round < 10; ++round) {
+        CHACHA_QUARTER(x[0], x[4], x[8], x[12])
+        CHACHA_QUARTER(x[1], x[5], x[9], x[13])
+        CHACHA_QUARTER(x[2], x[6], x[10], x[14])
+        CHACHA_QUARTER(x[3], x[7], x[11], x[15])
+        CHACHA_QUARTER(x[0], x[5], x[10], x[15])
+        CHACHA_QUARTER(x[1], x[6], x[11], x[12])
+        CHACHA_QUARTER(x[2], x[7], x[8], x[13])
+        CHACHA_QUARTER(x[3], x[4], x[9], x[14])
+    }
+}
+
+inline void chachaBlock(const uint32_t state[16], uint8_t out[CHACHA_BLOCK_SIZE]) {
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    chachaRounds(x);
+    for(int i = 0; i < 16; ++i) {
+        storeLe32(out + 4 * i, x[i] + state[i]);
+    }
+}
+
+// HChaCha20: a subkey from the key and 16 bytes of input, for the per session keys
+inline void hchacha20(const uint8_t key[CHACHA_KEY_SIZE], const uint8_t input[16], uint8_t out[CHACHA_KEY_SIZE]) {
+    ChaChaKey words;
+    words.load(key);
+    uint32_t x[16];
+    chachaState(x, words, loadLe32(input), input + 4);
+    chachaRounds(x);
+    for(int i = 0; i < 4; ++i) {
+        storeLe32(out + 4 * i, x[i]);
+        storeLe32(out + 16 + 4 * i, x[12 + i]);
+    }
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+// four blocks side by side: word i of the state of the four blocks in one vector
+#if defined(__SSE2__)
+typedef __m128i ChaChaVec;
+inline ChaChaVec vecAdd(ChaChaVec a, ChaChaVec b) { return _mm_add_epi32(a, b); }
+inline ChaChaVec vecXor(ChaChaVec a, ChaChaVec b) { return _mm_xor_si128(a, b); }
+template <int N> inline ChaChaVec vecRotl(ChaChaVec a) { return _mm_or_si128(_mm_slli_epi32(a, N), _mm_srli_epi32(a, 32 - N)); }
+inline ChaChaVec vecSplat(uint32_t value) { return _mm_set1_epi32(static_cast<int>(value)); }
+inline ChaChaVec vecCounters() { return _mm_set_epi32(3, 2, 1, 0); }
+inline ChaChaVec vecLoad(const uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline void vecStore(uint8_t* p, ChaChaVec v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+// from word i of four blocks to four words of block i
+inline void vecTranspose(ChaChaVec& a, ChaChaVec& b, ChaChaVec& c, ChaChaVec& d) {
+    __m128i ab0 = _mm_unpacklo_epi32(a, b);
+    __m128i cd0 = _mm_unpacklo_epi32(c, d);
+    __m128i ab1 = _mm_unpackhi_epi32(a, b);
+    __m128i cd1 = _mm_unpackhi_epi32(c, d);
+    a = _mm_unpacklo_epi64(ab0, cd0);
+    b = _mm_unpackhi_epi64(ab0, cd0);
+    c = _mm_unpacklo_epi64(ab1, cd1);
+    d = _mm_unpackhi_epi64(ab1, cd1);
+}
+#else
+typedef uint32x4_t ChaChaVec;
+inline ChaChaVec vecAdd(ChaChaVec a, ChaChaVec b) { return vaddq_u32(a, b); }
+inline ChaChaVec vecXor(ChaChaVec a, ChaChaVec b) { return veorq_u32(a, b); }
+template <int N> inline ChaChaVec vecRotl(ChaChaVec a) { return vsriq_n_u32(vshlq_n_u32(a, N), a, 32 - N); }
+inline ChaChaVec vecSplat(uint32_t value) { return vdupq_n_u32(value); }
+inline ChaChaVec vecCounters() { static const uint32_t counters[4] = {0, 1, 2, 3}; return vld1q_u32(counters); }
+inline ChaChaVec vecLoad(const uint8_t* p) { return vreinterpretq_u32_u8(vld1q_u8(p)); }
+inline void vecStore(uint8_t* p, ChaChaVec v) { vst1q_u8(p, vreinterpretq_u8_u32(v)); }
+inline void vecTranspose(ChaChaVec& a, ChaChaVec& b, ChaChaVec& c, ChaChaVec& d) {
+    uint32x4x2_t ab = vtrnq_u32(a, b);
+    uint32x4x2_t cd = vtrnq_u32(c, d);
+    a = vcombine_u32(vget_low_u32(ab.val[0]), vget_low_u32(cd.val[0]));
+    b = vcombine_u32(vget_low_u32(ab.val[1]), vget_low_u32(cd.val[1]));
+    c = vcombine_u32(vget_high_u32(ab.val[0]), vget_high_u32(cd.val[0]));
+    d = vcombine_u32(vget_high_u32(ab.val[1]), vget_high_u32(cd.val[1]));
+}
+#endif
+
+#define CHACHA_VEC_QUARTER(a, b, c, d) \
+    a = vecAdd(a, b); d = vecRotl<16>(vecXor(d, a)); \
+    c = vecAdd(c, d); b = vecRotl<12>(vecXor(b, c)); \
+    a = vecAdd(a, b); d = vecRotl<8>(vecXor(d, a)); \
+    c = vecAdd(c, d); b = vecRotl<7>(vecXor(b, c));
+
+// xors four blocks of key stream (counters state[12] to state[12] + 3) into 256 bytes of data
+inline void chachaXor4(const uint32_t state[16], uint8_t* data) {
+    ChaChaVec input[16];
+    ChaChaVec x[16];
+    for(int i = 0; i < 16; ++i) {
+        input[i] = vecSplat(state[i]);
+    }
+    input[12] = vecAdd(input[12], vecCounters());
+    for(int i = 0; i < 16; ++i) {
+        x[i] = input[i];
+    }
+    for(int round = 0; round < 10; ++round) {
+        CHACHA_VEC_QUARTER(x[0], x[4], x[8], x[12])
+        CHACHA_VEC_QUARTER(x[1], x[5], x[9], x[13])
+        CHACHA_VEC_QUARTER(x[2], x[6], x[10], x[14])
+        CHACHA_VEC_QUARTER(x[3], x[7], x[11], x[15])
+        CHACHA_VEC_QUARTER(x[0], x[5], x[10], x[15])
+        CHACHA_VEC_QUARTER(x[1], x[6], x[11], x[12])
+        CHACHA_VEC_QUARTER(x[2], x[7], x[8], x[13])
+        CHACHA_VEC_QUARTER(x[3], x[4], x[9], x[14])
+    }
+    for(int i = 0; i < 16; ++i) {
+        x[i] = vecAdd(x[i], input[i]);
+    }
+    // words 4q to 4q + 3 of the four blocks, block b at byte 64 b (both targets are little endian)
+    for(int q = 0; q < 4; ++q) {
+        vecTranspose(x[4 * q], x[4 * q + 1], x[4 * q + 2], x[4 * q + 3]);
+        for(int b = 0; b < 4; ++b) {
+            uint8_t* p = data + CHACHA_BLOCK_SIZE * b + 16 * q;
+            vecStore(p, vecXor(vecLoad(p), x[4 * q + b]));
+        }
+    }
+}
+
+#endif
+
+// encrypts / decrypts in place, the key stream starts with block counter
+inline void chachaXor(const ChaChaKey& key, uint32_t counter, const uint8_t nonce[CHACHA_NONCE_SIZE], uint8_t* data, size_t length) {
+    uint32_t state[16];
+    chachaState(state, key, counter, nonce);
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for(; length >= 4 * CHACHA_BLOCK_SIZE; length -= 4 * CHACHA_BLOCK_SIZE, data += 4 * CHACHA_BLOCK_SIZE) {
+        chachaXor4(state, data);
+        state[12] += 4;
+    }
+#endif
+    uint8_t stream[CHACHA_BLOCK_SIZE];
+    while(length > 0) {
+        chachaBlock(state, stream);
+        ++state[12];
+        size_t count = length < CHACHA_BLOCK_SIZE ? length : CHACHA_BLOCK_SIZE;
+        for(size_t i = 0; i < count; ++i) {
+            data[i] ^= stream[i];
+        }
+        data += count;
+        length -= count;
+    }
+}
+
+class Poly1305 {
+public:
+    explicit Poly1305(const uint8_t key[32]) {
+        // r is clamped as the rfc says
+        r[0] = loadLe32(key) & 0x3ffffff;
+        r[1] = (loadLe32(key + 3) >> 2) & 0x3ffff03;
+        r[2] = (loadLe32(key + 6) >> 4) & 0x3ffc0ff;
+        r[3] = (loadLe32(key + 9) >> 6) & 0x3f03fff;
+        r[4] = (loadLe32(key + 12) >> 8) & 0x00fffff;
+        for(int i = 0; i < 5; ++i) {
+            h[i] = 0;
+        }
+        for(int i = 0; i < 4; ++i) {
+            pad[i] = loadLe32(key + 16 + 4 * i);
+        }
+    }
+
+    // whole blocks, a shorter end is padded with zeros (the padding of the AEAD)
+    void update(const uint8_t* data, size_t length) {
+        size_t whole = length & ~static_cast<size_t>(15);
+        blocks(data, whole);
+        if(whole != length) {
+            uint8_t last[16] = {0};
+            memcpy(last, data + whole, length - whole);
+            blocks(last, 16);
+        }
+    }
+
+    void finish(uint8_t tag[POLY1305_TAG_SIZE]) {
+        uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+        uint32_t c = h1 >> 26; h1 &= 0x3ffffff;
+        h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+        h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+        h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+        // h - p, taken when h >= p (without a branch on h)
+        uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+        uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+        uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+        uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+        uint32_t g4 = h4 + c - (1u << 26);
+        uint32_t mask = (g4 >> 31) - 1;
+        h0 = (h0 & ~mask) | (g0 & mask);
+        h1 = (h1 & ~mask) | (g1 & mask);
+        h2 = (h2 & ~mask) | (g2 & mask);
+        h3 = (h3 & ~mask) | (g3 & mask);
+        h4 = (h4 & ~mask) | (g4 & mask);
+        // (h + pad) mod 2^128
+        uint32_t words[4];
+        words[0] = h0 | (h1 << 26);
+        words[1] = (h1 >> 6) | (h2 << 20);
+        words[2] = (h2 >> 12) | (h3 << 14);
+        words[3] = (h3 >> 18) | (h4 << 8);
+        uint64_t f = 0;
+        for(int i = 0; i < 4; ++i) {
+            f = static_cast<uint64_t>(words[i]) + pad[i] + (f >> 32);
+            storeLe32(tag + 4 * i, static_cast<uint32_t>(f));
+        }
+    }
+
+private:
+    void blocks(const uint8_t* data, size_t length) {
+        const uint64_t r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3], r4 = r[4];
+        const uint64_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+        uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+        for(; length >= 16; length -= 16, data += 16) {
+            h0 += loadLe32(data) & 0x3ffffff;
+            h1 += (loadLe32(data + 3) >> 2) & 0x3ffffff;
+            h2 += (loadLe32(data + 6) >> 4) & 0x3ffffff;
+            h3 += (loadLe32(data + 9) >> 6) & 0x3ffffff;
+            h4 += (loadLe32(data + 12) >> 8) | (1u << 24);
+            uint64_t d0 = h0 * r0 + h1 * s4 + h2 * s3 + h3 * s2 + h4 * s1;
+            uint64_t d1 = h0 * r1 + h1 * r0 + h2 * s4 + h3 * s3 + h4 * s2;
+            uint64_t d2 = h0 * r2 + h1 * r1 + h2 * r0 + h3 * s4 + h4 * s3;
+            uint64_t d3 = h0 * r3 + h1 * r2 + h2 * r1 + h3 * r0 + h4 * s4;
+            uint64_t d4 = h0 * r4 + h1 * r3 + h2 * r2 + h3 * r1 + h4 * r0;
+            uint32_t c = static_cast<uint32_t>(d0 >> 26); h0 = static_cast<uint32_t>(d0) & 0x3ffffff;
+            d1 += c; c = static_cast<uint32_t>(d1 >> 26); h1 = static_cast<uint32_t>(d1) & 0x3ffffff;
+            d2 += c; c = static_cast<uint32_t>(d2 >> 26); h2 = static_cast<uint32_t>(d2) & 0x3ffffff;
+            d3 += c; c = static_cast<uint32_t>(d3 >> 26); h3 = static_cast<uint32_t>(d3) & 0x3ffffff;
+            d4 += c; c = static_cast<uint32_t>(d4 >> 26); h4 = static_cast<uint32_t>(d4) & 0x3ffffff;
+            h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+            h1 += c;
+        }
+        h[0] = h0; h[1] = h1; h[2] = h2; h[3] = h3; h[4] = h4;
+    }
+
+    uint32_t r[5];
+    uint32_t h[5];
+    uint32_t pad[4];
+};
+
+// the tag of the AEAD over the associated data and the ciphertext, with the key of block 0
+inline void chachaPolyTag(const ChaChaKey& key, const uint8_t nonce[CHACHA_NONCE_SIZE], const uint8_t* aad, size_t aadLength,
+                          const uint8_t* ciphertext, size_t length, uint8_t tag[POLY1305_TAG_SIZE]) {
+    uint32_t state[16];
+    uint8_t block[CHACHA_BLOCK_SIZE];
+    chachaState(state, key, 0, nonce);
+    chachaBlock(state, block);
+    Poly1305 poly(block);
+    poly.update(aad, aadLength);
+    poly.update(ciphertext, length);
+    uint8_t lengths[16];
+    storeLe64(lengths, aadLength);
+    storeLe64(lengths + 8, length);
+    poly.update(lengths, 16);
+    poly.finish(tag);
+}
+
+// encrypts data in place and writes the tag
+inline void chachaPolySeal(const ChaChaKey& key, const uint8_t nonce[CHACHA_NONCE_SIZE], const uint8_t* aad, size_t aadLength,
+                           uint8_t* data, size_t length, uint8_t tag[POLY1305_TAG_SIZE]) {
+    chachaXor(key, 1, nonce, data, length);
+    chachaPolyTag(key, nonce, aad, aadLength, data, length, tag);
+}
+
+// checks the tag (in constant time) and only then decrypts in place
+inline bool chachaPolyOpen(const ChaChaKey& key, const uint8_t nonce[CHACHA_NONCE_SIZE], const uint8_t* aad, size_t aadLength,
+                           uint8_t* data, size_t length, const uint8_t tag[POLY1305_TAG_SIZE]) {
+    uint8_t expected[POLY1305_TAG_SIZE];
+    chachaPolyTag(key, nonce, aad, aadLength, data, length, expected);
+    uint8_t difference = 0;
+    for(int i = 0; i < POLY1305_TAG_SIZE; ++i) {
+        difference |= static_cast<uint8_t>(expected[i] ^ tag[i]);
+    }
+    if(difference != 0) {
+        return false;
+    }
+    chachaXor(key, 1, nonce, data, length);
+    return true;
+}
+
+#endif
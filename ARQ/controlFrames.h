@@ -0,0 +1,66 @@
+#ifndef CONTROL_FRAMES_H
+#define CONTROL_FRAMES_H
+
+// Control frames of the ARQ core (arqCore.h).
+// Wire format v2: an ip packet is sent as data fragments with the sequence numbers 1 to 62, there is no start message
+// (sequence number 0 is not used anymore). Fragment 1 begins with the ipv4 header, whose total length tells the
+// receiver the size of the packet and so how many fragments to expect (see packetSizeOf). The CRC32C of the packet
+// follows its last byte (see crc32c.h), the fragments carry its size + 4 bytes.
+// A data frame (most significant bit 0) with sequence number 63 is a control frame and its second byte tells which one.
+// An acknowledgement with sequence number 63 (0xbf / 0xff) means the ip packet with that alternating bit is
+// concluded on the other side (all received, or dropped after an abort).
+// A frame starting with an acknowledgement may carry more of them, one per byte, as long as the bytes have the most
+// significant bit set (the tx arbiter coalesces the pending ones, see txArbiter.h).
+
+#include <stdint.h>
+
+// payload of an nRF24 frame
+#define RADIO_FRAME_SIZE 32
+// the largest frame of any link (see frameGeometry.h)
+#define LINK_FRAME_MAX 250
+
+#define CONTROL_SEQ 63
+
+// the sender gave up on the ip packet with the alternating bit of the header -> the receiver frees what it has of it
+#define CONTROL_ABORT 1
+// session handshake and liveness, see session.h
+#define CONTROL_HELLO 2
+#define CONTROL_HELLO_ACK 3
+#define CONTROL_KEEPALIVE 4
+// the sender asks for the naks (nak policy) or the bitmap (block policy) of the ip packet with the alternating bit of
+// the header, the third byte is its number of fragments (the receiver may not know it, when fragment 1 was lost)
+#define CONTROL_POLL 5
+// the sender uses the acknowledgement policy in the third byte (arqPolicy.h) from the next ip packet on, the receiver
+// confirms it with CONTROL_POLICY_ACK carrying the same byte
+#define CONTROL_POLICY 6
+#define CONTROL_POLICY_ACK 7
+// the answer of the receiver to a poll with the block policy: bytes 2 to 9 are a bitmap of the sequence numbers received
+// (bit seq % 8 of byte 2 + seq / 8) of the ip packet with the alternating bit of the header
+#define CONTROL_BLOCK_ACK 8
+#define CONTROL_BLOCK_ACK_SIZE 10
+// the receiver had all the fragments of the ip packet with the alternating bit of the header, but its crc was wrong and
+// it dropped them. With positive acks it answers the fragments of the packet with this instead of acks, until the
+// sender confirms with CONTROL_CORRUPT_ACK and sends every fragment again (naks / bitmaps ask for them anyway).
+#define CONTROL_CORRUPT 9
+#define CONTROL_CORRUPT_ACK 10
+// the credits of the receiver (see flowControl.h): byte 2 the free packet buffers, bytes 3 and 4 the time in us it takes
+// to drain a frame from its radio (little endian), byte 5 how often it found its RX FIFO full (modulo 256, see txPacer.h)
+#define CONTROL_CREDIT 11
+#define CONTROL_CREDIT_SIZE 6
+// a fragment of an ip packet on the unacknowledged fast path (see fastPath.h): byte 2 the id of the packet (modulo 256),
+// byte 3 the index of the fragment (0 begins with the ipv4 header), the fragment follows, the crc of the packet behind it
+#define CONTROL_DATAGRAM 12
+#define CONTROL_DATAGRAM_HEADER 4
+
+inline bool isControlFrame(uint8_t header) {
+    return (header & 0x80) == 0 && (header & 0x3F) == CONTROL_SEQ;
+}
+
+// the size of the ip packet from the ipv4 header at the start of fragment 1, false if it can not be one of ours
+inline bool packetSizeOf(const uint8_t* fragment, int maxPacket, uint16_t& size) {
+    size = static_cast<uint16_t>((fragment[2] << 8) | fragment[3]);
+    return (fragment[0] >> 4) == 4 && (fragment[0] & 0x0F) >= 5 && size >= (fragment[0] & 0x0F) * 4
+           && size <= maxPacket;
+}
+
+#endif
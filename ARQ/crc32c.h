@@ -0,0 +1,107 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+// CRC32C (Castagnoli) of every ip packet, carried behind it in its last fragment (see controlFrames.h).
+// The crc of the nRF24 covers only a frame and misses some corruptions, the receiver checks this one when it has all
+// the fragments, before the packet is concluded, so a corrupted packet is sent again instead of written to tun0.
+// The crc instructions do it when the build allows them: SSE4.2 (-msse4.2) or ARMv8 (-march=armv8-a+crc, the
+// Raspberry Pi 3 and later), otherwise a table does it a byte at a time.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define CRC32C_IMPL "sse4.2"
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_IMPL "armv8"
+#else
+#define CRC32C_IMPL "table"
+#endif
+
+#define CRC32C_SIZE 4
+
+struct Crc32cTable {
+    Crc32cTable() {
+        for(uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for(int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            }
+            entries[i] = crc;
+        }
+    }
+
+    uint32_t entries[256];
+};
+
+inline const Crc32cTable& crc32cTable() {
+    static Crc32cTable table;
+    return table;
+}
+
+inline uint32_t crc32c(const uint8_t* data, size_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+#if defined(__SSE4_2__)
+#if defined(__x86_64__)
+    for(; length >= 8; length -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+    }
+#endif
+    for(; length >= 4; length -= 4, data += 4) {
+        uint32_t word;
+        memcpy(&word, data, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for(; length > 0; --length) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+#elif defined(__ARM_FEATURE_CRC32)
+#if defined(__aarch64__)
+    for(; length >= 8; length -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+    }
+#endif
+    for(; length >= 4; length -= 4, data += 4) {
+        uint32_t word;
+        memcpy(&word, data, 4);
+        crc = __crc32cw(crc, word);
+    }
+    for(; length > 0; --length) {
+        crc = __crc32cb(crc, *data++);
+    }
+#else
+    const Crc32cTable& table = crc32cTable();
+    for(; length > 0; --length) {
+        crc = (crc >> 8) ^ table.entries[(crc ^ *data++) & 0xFF];
+    }
+#endif
+    return ~crc;
+}
+
+// writes the crc of the packet right behind it (little endian), there must be CRC32C_SIZE bytes of room
+inline void appendCrc32c(uint8_t* packet, size_t length) {
+    uint32_t crc = crc32c(packet, length);
+    for(int i = 0; i < CRC32C_SIZE; ++i) {
+        packet[length + i] = static_cast<uint8_t>(crc >> (8 * i));
+    }
+}
+
+// true when the crc behind the packet is the one of its bytes
+inline bool checkCrc32c(const uint8_t* packet, size_t length) {
+    uint32_t crc = crc32c(packet, length);
+    for(int i = 0; i < CRC32C_SIZE; ++i) {
+        if(packet[length + i] != static_cast<uint8_t>(crc >> (8 * i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef FAST_PATH_H
+#define FAST_PATH_H
+
+// The unacknowledged fast path (--fast-path): the ip packets of the real-time class (DSCP EF, CS4, CS5, AF4x or udp on
+// one of --realtime-ports, see trafficClass.h) skip the ARQ. The sender of the ARQ has one packet on air at a time and
+// resends it until it is acknowledged, a voice frame behind a tcp segment being resent arrives late, which for it is as
+// good as lost. On the fast path nothing is acknowledged or resent, the tcp flows keep the ARQ:
+// - the tun reader frames the packet itself and queues the frames with the tx arbiter, which sends them after the
+//   control frames and before the data of the ARQ, paced like data (see txArbiter.h)
+// - a packet is sent as CONTROL_DATAGRAM frames (controlFrames.h) with an 8 bit id, sealed with --psk (on a channel of
+//   its own, see linkCrypto.h) and with its crc behind it, like a packet of the ARQ
+// - the receiver reassembles one packet at a time in a buffer of the incoming pipe: a frame of a newer id ends the
+//   packet before (lost if incomplete), the ids skipped are lost too, a frame of an older id is late and dropped
+// - a packet whose frames do not all fit into the queue of the arbiter is dropped whole (it would be late), one larger
+//   than FAST_PATH_MAX_FRAGMENTS frames carry takes the ARQ
+// The packet being reassembled is not handed over in a hot restart, it is lost as if on air.
+
+#include <atomic>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include "controlFrames.h"
+#include "txArbiter.h"
+#include "session.h"
+#include "linkCrypto.h"
+#include "crc32c.h"
+#include "pipeline.h"
+#include "asyncLog.h"
+
+// the fragments of a packet are a bitmap of 64 bits
+#define FAST_PATH_MAX_FRAGMENTS 64
+
+// the settings and the counters of the fast path, whatever the frames of the link
+class FastPath {
+public:
+    FastPath() : enabled(false), sent(0), received(0), lost(0), late(0), corrupted(0), dropped(0) {}
+
+    void logStats() const {
+        if(!enabled && received.load() == 0) {
+            return;
+        }
+        LOG_INFO(LOG_MAIN, "fast path: {} packets sent, {} dropped before sending, {} received, {} lost", sent.load(), dropped.load(), received.load(), lost.load());
+        LOG_INFO(LOG_MAIN, "fast path received: {} frames late, {} packets with a wrong crc", late.load(), corrupted.load());
+    }
+
+    bool enabled;   // set before the threads start
+
+    // statistics
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> lost;         // ids never completed
+    std::atomic<uint64_t> late;         // frames of an id older than the last one
+    std::atomic<uint64_t> corrupted;
+    std::atomic<uint64_t> dropped;      // packets not (all) sent: no session, or no room in the queue of the arbiter
+};
+
+// the one fast path of the link
+inline FastPath& fastPath() {
+    static FastPath instance;
+    return instance;
+}
+
+// framing and reassembly of the fast path for the frame geometry of the link (frameGeometry.h), like ArqCore. A
+// datagram is a control frame, it has no piggyback trailer: the whole frame after its header carries the packet.
+template <typename Geometry>
+class FastPathLink {
+public:
+    static const int payload = Geometry::frameSize - CONTROL_DATAGRAM_HEADER;
+    static const int maxPacket = (PACKET_BUFFER_SIZE < FAST_PATH_MAX_FRAGMENTS * payload ? PACKET_BUFFER_SIZE : FAST_PATH_MAX_FRAGMENTS * payload) - CRC32C_SIZE;
+
+    FastPathLink() : nextId(0), assembling(NULL), assemblingId(0), expectedId(0), idKnown(false), inProgress(false), sizeKnown(false),
+                     packetSize(0), fragmentsToReceive(0), fragmentMask(0) {}
+
+    // ---- tun reader thread ----
+
+    // frames the packet and queues its frames, true when the packet is done with (queued or dropped), false when it
+    // has to take the ARQ
+    bool send(PacketBuffer* packet) {
+        FastPath& stats = fastPath();
+        int total = packet->length + (linkCrypto().enabled ? LINK_CRYPTO_OVERHEAD : 0) + CRC32C_SIZE;
+        int fragments = (total + payload - 1) / payload;
+        // the receiver takes the size from the ip header in fragment 0, the ARQ drops the packet if it is wrong
+        uint16_t headerSize;
+        if(total > maxPacket + CRC32C_SIZE || !packetSizeOf(packet->data, PACKET_BUFFER_SIZE, headerSize) || headerSize != packet->length) {
+            return false;
+        }
+        // no session (the peer could not open it) or no room for all of it, a real-time packet does not wait
+        if(!session().established.load() || !session().peerAlive() || txArbiter().waiting(TX_PRIORITY_DATAGRAM) + fragments > TX_QUEUE_SIZE) {
+            stats.dropped.fetch_add(1, std::memory_order_relaxed);
+            LOG_DEBUG(LOG_SEND, "Dropped a packet of the fast path, {} bytes, dropped so far: {}", packet->length, stats.dropped.load());
+            return true;
+        }
+        if(linkCrypto().enabled) {
+            linkCrypto().seal(packet->data, packet->length, session().localEpoch, session().peerEpoch.load(), LINK_CHANNEL_FAST);
+        }
+        appendCrc32c(packet->data, packet->length);
+        packet->length += CRC32C_SIZE;
+        uint8_t frame[Geometry::frameSize];
+        frame[0] = CONTROL_SEQ;
+        frame[1] = CONTROL_DATAGRAM;
+        frame[2] = nextId++;
+        for(int index = 0; index < fragments; ++index) {
+            int offset = index * payload;
+            int cap = std::min(payload, packet->length - offset);
+            frame[3] = static_cast<uint8_t>(index);
+            memcpy(frame + CONTROL_DATAGRAM_HEADER, packet->data + offset, cap);
+            // the rest would reach the peer as a packet it can not complete, the frames queued already count as lost there
+            if(!txArbiter().send(TX_PRIORITY_DATAGRAM, frame, static_cast<uint8_t>(cap + CONTROL_DATAGRAM_HEADER))) {
+                stats.dropped.fetch_add(1, std::memory_order_relaxed);
+                LOG_DEBUG(LOG_SEND, "Dropped a packet of the fast path after {} of {} frames, the queue was full", index, fragments);
+                return true;
+            }
+        }
+        stats.sent.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // ---- receiver thread ----
+
+    // a CONTROL_DATAGRAM frame of the peer (zeros behind its length), a complete packet goes to the tun writer
+    void receive(const uint8_t* frame, PacketPipe& incoming) {
+        FastPath& stats = fastPath();
+        uint8_t id = frame[2];
+        uint8_t index = frame[3];
+        if(!idKnown || id != assemblingId) {
+            uint8_t ahead = static_cast<uint8_t>(id - expectedId);
+            if(idKnown && ahead >= 128) {
+                stats.late.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            // the packet before is over, what did not come of it and the ones in between are lost
+            uint64_t missed = (inProgress ? 1 : 0) + (idKnown ? ahead : 0);
+            if(missed != 0) {
+                stats.lost.fetch_add(missed, std::memory_order_relaxed);
+                LOG_DEBUG(LOG_RECEIVE, "Lost {} packets of the fast path before id {}, lost so far: {}", missed, id, stats.lost.load());
+            }
+            idKnown = true;
+            assemblingId = id;
+            expectedId = static_cast<uint8_t>(id + 1);
+            sizeKnown = false;
+            fragmentMask = 0;
+            inProgress = true;
+            // we keep the buffer until a packet is complete, the tun writer gives it back
+            if(assembling == NULL) {
+                assembling = incoming.freeBuffers.tryPop();
+            }
+            if(assembling == NULL) {
+                incoming.dropped.fetch_add(1, std::memory_order_relaxed);
+                stats.lost.fetch_add(1, std::memory_order_relaxed);
+                inProgress = false;
+            }
+        }
+        int offset = index * payload;
+        if(!inProgress || offset >= maxPacket + CRC32C_SIZE || (fragmentMask & (1ULL << index)) != 0) {
+            return;
+        }
+        memcpy(assembling->data + offset, frame + CONTROL_DATAGRAM_HEADER, std::min(payload, PACKET_BUFFER_SIZE - offset));
+        fragmentMask |= 1ULL << index;
+        if(index == 0) {
+            if(!packetSizeOf(frame + CONTROL_DATAGRAM_HEADER, maxPacket, packetSize)) {
+                stats.corrupted.fetch_add(1, std::memory_order_relaxed);
+                inProgress = false;
+                return;
+            }
+            sizeKnown = true;
+            fragmentsToReceive = (packetSize + CRC32C_SIZE + payload - 1) / payload;
+        }
+        if(!sizeKnown) {
+            return;
+        }
+        uint64_t all = fragmentsToReceive == FAST_PATH_MAX_FRAGMENTS ? ~0ULL : (1ULL << fragmentsToReceive) - 1;
+        if((fragmentMask & all) != all) {
+            return;
+        }
+        // the packet is over, the frames of its id that still come are ignored
+        inProgress = false;
+        if(!checkCrc32c(assembling->data, packetSize)) {
+            stats.corrupted.fetch_add(1, std::memory_order_relaxed);
+            LOG_WARN(LOG_RECEIVE, "The crc of a packet of the fast path of {} bytes was wrong, wrong so far: {}", packetSize, stats.corrupted.load());
+            return;
+        }
+        assembling->length = packetSize;
+        incoming.packets.push(assembling);
+        assembling = NULL;
+        stats.received.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // the peer restarted, its ids start again
+    void reset() {
+        idKnown = false;
+        inProgress = false;
+    }
+
+private:
+    // tun reader thread
+    uint8_t nextId;
+    // receiver thread
+    PacketBuffer* assembling;
+    uint8_t assemblingId;
+    uint8_t expectedId;
+    bool idKnown;
+    bool inProgress;
+    bool sizeKnown;
+    uint16_t packetSize;
+    int fragmentsToReceive;
+    uint64_t fragmentMask;
+};
+
+template <typename Geometry> const int FastPathLink<Geometry>::payload;
+template <typename Geometry> const int FastPathLink<Geometry>::maxPacket;
+
+// the fast path of the link with the geometry
+template <typename Geometry>
+inline FastPathLink<Geometry>& fastPathLink() {
+    static FastPathLink<Geometry> instance;
+    return instance;
+}
+
+#endif
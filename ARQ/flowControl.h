@@ -0,0 +1,136 @@
+#ifndef FLOW_CONTROL_H
+#define FLOW_CONTROL_H
+
+// Credit based flow control between the stations, so the sender does not send what the receiver of the peer can not take.
+// The receiver advertises two credits in a CONTROL_CREDIT frame (see controlFrames.h):
+// - packets: the free buffers of its incoming pipe. A packet received while there is none is dropped after all its
+//   fragments went on air, so the sender does not start a packet while the peer has no buffer for it
+// - frames: how long the receiver takes to drain a frame from its radio (to acknowledge and reassemble it). A sender
+//   faster than that fills the 3 frame RX FIFO and the frames behind are lost, so the tx arbiter sends the data frames
+//   at most at that rate, with as many back to back as the FIFO holds (see TxArbiter::setDrainUs)
+// With them goes how often the receiver found its RX FIFO full, the pacer of the peer backs off on it (see txPacer.h).
+// The credits are advertised when they change (at most every FLOW_CREDIT_CHANGE_MS, the buffers only when few are left,
+// running out of them at once) and every FLOW_CREDIT_REFRESH_MS anyway, a lost advertisement only delays the next one.
+// The sender keeps to the last one. Until the peer advertises anything (an older peer, a restart) nothing is limited.
+
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+#include "controlFrames.h"
+#include "txArbiter.h"
+#include "txPacer.h"
+#include "asyncLog.h"
+
+#define FLOW_CREDIT_CHANGE_MS 10
+#define FLOW_CREDIT_REFRESH_MS 100
+// fewer free buffers than this are worth telling as soon as they change, more only with the refresh
+#define FLOW_CREDIT_LOW 4
+// the drain time is a moving average, a new sample counts 1/8
+#define FLOW_DRAIN_WEIGHT 8
+// the most a drain time sample may count, a receiver preempted once is not a slow one
+#define FLOW_DRAIN_MAX_US 500
+// a drain time is advertised again when it changed by an 1/8, or by this much when it is short
+#define FLOW_DRAIN_TOLERANCE_US 8
+
+class FlowControl {
+public:
+    FlowControl() : enabled(true), packetCredits(-1), creditStalls(0), advertisements(0), rxFifoFull(0), drainNs(0), advertisedBuffers(-1),
+                    advertisedDrainUs(-1), lastAdvertisedMs(0), fifoWasFull(false), advertisedFifoFull(0) {}
+
+    static int64_t nowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // ---- receiver thread ----
+
+    // the time from finding a frame in the radio to being ready for the next one
+    void recordDrain(uint64_t ns) {
+        int64_t sample = static_cast<int64_t>(std::min<uint64_t>(ns, FLOW_DRAIN_MAX_US * 1000ULL));
+        drainNs += (sample - drainNs) / FLOW_DRAIN_WEIGHT;
+    }
+
+    // the RX FIFO was full when we found a frame, counted once until it is not full anymore
+    void recordFifo(bool full) {
+        if(full && !fifoWasFull) {
+            rxFifoFull.fetch_add(1, std::memory_order_relaxed);
+        }
+        fifoWasFull = full;
+    }
+
+    // advertises the credits of our receiver to the sender of the peer, if they changed or it is time again
+    void advertise(int freeBuffers) {
+        if(!enabled) {
+            return;
+        }
+        int64_t now = nowMs();
+        int drainUs = static_cast<int>(drainNs / 1000);
+        int drainTolerance = std::max(advertisedDrainUs / 8, FLOW_DRAIN_TOLERANCE_US);
+        bool changed = (freeBuffers != advertisedBuffers && std::min(freeBuffers, advertisedBuffers) <= FLOW_CREDIT_LOW)
+                       || drainUs > advertisedDrainUs + drainTolerance || drainUs < advertisedDrainUs - drainTolerance;
+        // running out of buffers (or getting one again) is told right away, the sender waits on it
+        // and so is a full FIFO, the sender backs off on it
+        uint8_t fifoFull = static_cast<uint8_t>(rxFifoFull.load(std::memory_order_relaxed));
+        bool urgent = (freeBuffers == 0) != (advertisedBuffers == 0) || fifoFull != advertisedFifoFull;
+        if(!urgent && now - lastAdvertisedMs < (changed ? FLOW_CREDIT_CHANGE_MS : FLOW_CREDIT_REFRESH_MS)) {
+            return;
+        }
+        uint8_t frame[CONTROL_CREDIT_SIZE] = {CONTROL_SEQ, CONTROL_CREDIT, static_cast<uint8_t>(std::min(freeBuffers, 255)),
+                                              static_cast<uint8_t>(drainUs & 0xFF), static_cast<uint8_t>(drainUs >> 8), fifoFull};
+        if(txArbiter().send(TX_PRIORITY_CONTROL, frame, CONTROL_CREDIT_SIZE)) {
+            advertisedBuffers = freeBuffers;
+            advertisedDrainUs = drainUs;
+            lastAdvertisedMs = now;
+            advertisedFifoFull = fifoFull;
+            advertisements.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // the credits advertised by the receiver of the peer
+    void onCredit(const uint8_t* frame) {
+        if(!enabled) {
+            return;
+        }
+        packetCredits.store(frame[2], std::memory_order_relaxed);
+        txArbiter().setDrainUs(frame[3] | (frame[4] << 8));
+        txPacer().onPeerFifoFull(frame[5]);
+    }
+
+    // ---- sender thread ----
+
+    // true when the peer has a buffer for another packet (or did not tell)
+    bool hasPacketCredit() const {
+        return !enabled || packetCredits.load(std::memory_order_relaxed) != 0;
+    }
+
+    // the peer restarted, what it advertised is gone with it
+    void reset() {
+        packetCredits.store(-1, std::memory_order_relaxed);
+        txArbiter().setDrainUs(0);
+    }
+
+    // set before the threads start
+    bool enabled;
+
+    std::atomic<int> packetCredits;         // -1 = not advertised
+    std::atomic<uint64_t> creditStalls;     // packets that waited for a buffer of the peer
+    std::atomic<uint64_t> advertisements;
+    std::atomic<uint64_t> rxFifoFull;       // times our receiver found its RX FIFO full
+
+private:
+    // only the receiver thread uses these
+    int64_t drainNs;
+    int advertisedBuffers;
+    int advertisedDrainUs;
+    int64_t lastAdvertisedMs;
+    bool fifoWasFull;
+    uint8_t advertisedFifoFull;
+};
+
+// the one flow control of the link
+inline FlowControl& flowControl() {
+    static FlowControl instance;
+    return instance;
+}
+
+#endif
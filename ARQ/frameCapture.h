@@ -0,0 +1,250 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+// Low-overhead capture of every radio frame into a pcap file.
+// The hot loops only copy the frame into a lock-free ring (no syscalls, no locks, no blocking),
+// a background writer thread drains the ring to disk. When the ring is full frames are dropped and counted,
+// so the memory use is bounded and the timing of the protocol is not changed by a slow disk.
+// The pcap uses the LINKTYPE_USER0 link type, see nrf24arq.lua for the wireshark dissector.
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// number of frames the ring can hold (must be a power of two), 4096 * 48 bytes = 192 KiB
+#define CAPTURE_RING_SIZE 4096
+// pcap link type reserved for private use (wireshark: "DLT_USER0")
+#define CAPTURE_LINKTYPE_USER0 147
+// size of the pseudo header written in front of every frame in the pcap file
+#define CAPTURE_PSEUDO_HEADER_SIZE 4
+#define CAPTURE_PSEUDO_HEADER_VERSION 1
+// bytes of a frame kept, larger frames (links other than the nRF24, see frameGeometry.h) are cut, the pcap record
+// still tells their length
+#define CAPTURE_SNAPLEN 32
+
+// which radio the frame went through
+const uint8_t CAPTURE_RADIO_SEND = 0;
+const uint8_t CAPTURE_RADIO_RECEIVE = 1;
+// direction of the frame
+const uint8_t CAPTURE_TX = 0;
+const uint8_t CAPTURE_RX = 1;
+
+struct CapturedFrame {
+    uint64_t timestampNs;   // CLOCK_REALTIME, so the capture can be matched with tcpdump of tun0
+    uint8_t radio;
+    uint8_t direction;
+    uint8_t length;             // of the frame
+    uint8_t captured;           // bytes of it in data
+    uint8_t data[CAPTURE_SNAPLEN];
+};
+
+class FrameCapture {
+public:
+    FrameCapture() : enabled(false), running(false), file(NULL), enqueuePos(0), dequeuePos(0), dropped(0), written(0) {
+        for(size_t i = 0; i < CAPTURE_RING_SIZE; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~FrameCapture() {
+        stop();
+    }
+
+    // opens the pcap file and starts the background writer, capturing is enabled right away
+    bool start(const char* path) {
+        if(running.load()) {
+            return true;
+        }
+        file = fopen(path, "wb");
+        if(file == NULL) {
+            perror("Failed to open capture file");
+            return false;
+        }
+        if(!writeFileHeader()) {
+            fclose(file);
+            file = NULL;
+            return false;
+        }
+        running.store(true);
+        writer = std::thread(&FrameCapture::writerLoop, this);
+        enabled.store(true);
+        return true;
+    }
+
+    // stops capturing, writes out what is left in the ring and closes the file
+    void stop() {
+        enabled.store(false);
+        if(!running.exchange(false)) {
+            return;
+        }
+        writer.join();
+        fclose(file);
+        file = NULL;
+        if(dropped.load() != 0) {
+            std::cerr << "Frame capture: " << dropped.load() << " frames dropped (ring full)" << std::endl;
+        }
+    }
+
+    // runtime switch, can be called from a signal handler (only touches a lock-free atomic)
+    void setEnabled(bool on) {
+        enabled.store(on && running.load(), std::memory_order_relaxed);
+    }
+
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    // called from the hot loops, may be called from several threads at once
+    void record(uint8_t radio, uint8_t direction, const void* frame, uint8_t length) {
+        if(!enabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+        // bounded multi-producer queue: each cell has a sequence number telling whose turn it is
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true) {
+            cell = &cells[pos & (CAPTURE_RING_SIZE - 1)];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if(diff == 0) {
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if(diff < 0) {
+                // the ring is full -> we rather lose the frame than block the radio loop
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->frame.timestampNs = nowNs();
+        cell->frame.radio = radio;
+        cell->frame.direction = direction;
+        cell->frame.length = length;
+        cell->frame.captured = length < CAPTURE_SNAPLEN ? length : CAPTURE_SNAPLEN;
+        memcpy(cell->frame.data, frame, cell->frame.captured);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+    }
+
+    uint64_t droppedFrames() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    uint64_t writtenFrames() const {
+        return written.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        CapturedFrame frame;
+    };
+
+    static uint64_t nowNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+    bool writeFileHeader() {
+        // classic pcap header, magic 0xa1b23c4d means the timestamps are in nanoseconds
+        uint32_t magic = 0xa1b23c4d;
+        uint16_t versionMajor = 2;
+        uint16_t versionMinor = 4;
+        int32_t thisZone = 0;
+        uint32_t sigFigs = 0;
+        uint32_t snapLen = CAPTURE_PSEUDO_HEADER_SIZE + CAPTURE_SNAPLEN;
+        uint32_t linkType = CAPTURE_LINKTYPE_USER0;
+        bool ok = fwrite(&magic, 4, 1, file) == 1;
+        ok = ok && fwrite(&versionMajor, 2, 1, file) == 1;
+        ok = ok && fwrite(&versionMinor, 2, 1, file) == 1;
+        ok = ok && fwrite(&thisZone, 4, 1, file) == 1;
+        ok = ok && fwrite(&sigFigs, 4, 1, file) == 1;
+        ok = ok && fwrite(&snapLen, 4, 1, file) == 1;
+        ok = ok && fwrite(&linkType, 4, 1, file) == 1;
+        if(!ok) {
+            perror("Failed to write the capture file header");
+        }
+        return ok;
+    }
+
+    // takes one frame out of the ring, returns false if it is empty (only the writer thread calls this)
+    bool pop(CapturedFrame& out) {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Cell* cell = &cells[pos & (CAPTURE_RING_SIZE - 1)];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        if(static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0) {
+            return false;
+        }
+        out = cell->frame;
+        cell->sequence.store(pos + CAPTURE_RING_SIZE, std::memory_order_release);
+        dequeuePos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void writeRecord(const CapturedFrame& frame) {
+        uint32_t recordHeader[4];
+        recordHeader[0] = static_cast<uint32_t>(frame.timestampNs / 1000000000ULL);
+        recordHeader[1] = static_cast<uint32_t>(frame.timestampNs % 1000000000ULL);
+        recordHeader[2] = CAPTURE_PSEUDO_HEADER_SIZE + frame.captured; // captured length
+        recordHeader[3] = CAPTURE_PSEUDO_HEADER_SIZE + frame.length;   // original length
+        // pseudo header: version, radio, direction, length of the frame
+        uint8_t pseudoHeader[CAPTURE_PSEUDO_HEADER_SIZE] = {CAPTURE_PSEUDO_HEADER_VERSION, frame.radio, frame.direction, frame.length};
+        fwrite(recordHeader, sizeof(recordHeader), 1, file);
+        fwrite(pseudoHeader, sizeof(pseudoHeader), 1, file);
+        fwrite(frame.data, frame.captured, 1, file);
+        written.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void writerLoop() {
+        CapturedFrame frame;
+        while(running.load()) {
+            bool any = false;
+            while(pop(frame)) {
+                writeRecord(frame);
+                any = true;
+            }
+            if(any) {
+                fflush(file);
+            }
+            // nothing in the ring, we don't want to spin on a core the radio threads need
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        // drain what was captured before stopping
+        while(pop(frame)) {
+            writeRecord(frame);
+        }
+        fflush(file);
+    }
+
+    std::atomic<bool> enabled;
+    std::atomic<bool> running;
+    FILE* file;
+    std::thread writer;
+    Cell cells[CAPTURE_RING_SIZE];
+    std::atomic<size_t> enqueuePos;
+    std::atomic<size_t> dequeuePos;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> written;
+};
+
+// the one capture instance of the program
+inline FrameCapture& frameCapture() {
+    static FrameCapture instance;
+    return instance;
+}
+
+// writes a frame with the radio and records it in the capture
+template <typename Radio>
+inline bool captureWrite(Radio& radio, uint8_t radioId, const void* frame, uint8_t length) {
+    frameCapture().record(radioId, CAPTURE_TX, frame, length);
+    return radio.write(frame, length);
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef FRAME_GEOMETRY_H
+#define FRAME_GEOMETRY_H
+
+// How an ip packet is cut into the frames of a link, known at compile time, so the same ARQ core (arqCore.h) runs over
+// the 32 byte frames of the nRF24 radios and the larger frames of other links (the udp stand-in, see udpLink.h).
+// A frame is [header][fragment of the ip packet][trailer]: the one byte header of controlFrames.h (acknowledgement
+// bit, alternating bit, 6 bit sequence number) and the acknowledgement trailer of --piggyback at the end of the frame.
+// The sequence numbers 1 to 62 carry data, with large frames fewer are used: a packet must fit into a pipeline buffer.
+
+#include "controlFrames.h"
+#include "piggyback.h"
+#include "pipeline.h"
+
+template <int FrameSize, int TrailerSize>
+struct FrameGeometry {
+    static const int frameSize = FrameSize;
+    static const int headerSize = 1;
+    static const int trailerOffset = FrameSize - TrailerSize;
+    static const int payload = FrameSize - headerSize - TrailerSize;   // bytes of the ip packet per data fragment
+    static const int maxFragments = PACKET_BUFFER_SIZE / payload < CONTROL_SEQ - 1 ? PACKET_BUFFER_SIZE / payload : CONTROL_SEQ - 1;
+    static const int maxPacket = maxFragments * payload;
+
+    static_assert(FrameSize <= LINK_FRAME_MAX, "the tx arbiter queues frames of at most LINK_FRAME_MAX bytes");
+    static_assert(maxFragments * FrameSize <= PACKET_ARENA_SIZE, "the frames of a packet must fit into the arena of its buffer");
+};
+
+template <int FrameSize, int TrailerSize> const int FrameGeometry<FrameSize, TrailerSize>::frameSize;
+template <int FrameSize, int TrailerSize> const int FrameGeometry<FrameSize, TrailerSize>::headerSize;
+template <int FrameSize, int TrailerSize> const int FrameGeometry<FrameSize, TrailerSize>::trailerOffset;
+template <int FrameSize, int TrailerSize> const int FrameGeometry<FrameSize, TrailerSize>::payload;
+template <int FrameSize, int TrailerSize> const int FrameGeometry<FrameSize, TrailerSize>::maxFragments;
+template <int FrameSize, int TrailerSize> const int FrameGeometry<FrameSize, TrailerSize>::maxPacket;
+
+// the frames of a link without and with --piggyback
+template <int FrameSize>
+struct LinkFrames {
+    typedef FrameGeometry<FrameSize, 0> Plain;
+    typedef FrameGeometry<FrameSize, PIGGYBACK_TRAILER_SIZE> Piggyback;
+};
+
+#endif
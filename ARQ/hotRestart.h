@@ -0,0 +1,293 @@
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+
+// Hot restart: a new process (started with --takeover) takes the tun interface and the ARQ state over from the
+// running one, so an upgrade or a reload doesn't break the tcp connections going through the link.
+// - tun0 is persistent, it (with its address and routes) survives as long as one of the processes holds it
+// - the running process listens on an abstract unix socket, the new one connects and asks for a handover
+// - the stages of the old pipeline park one after the other (see pipeline.h): the tun reader stops reading, the sender
+//   finishes what was read already, then the receiver and the tun writer, so nothing is half done on the sending side
+//   (the packets not read yet wait in the queue of tun0, which is not lost as the fd is passed on)
+// - the old process sends the tun fd (SCM_RIGHTS) with the session epochs, alternating bits, the half reassembled
+//   packet and the counters of the sealed packets (--psk, a nonce must not be used again), and exits, the new one sets up the radios and continues where the old one stopped
+// The peer sees only a short silence (resends cover it) and the same epoch, so it does not resynchronize.
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "session.h"
+#include "frameCapture.h"
+#include "linkCrypto.h"
+#include "asyncLog.h"
+
+// abstract socket name (no file to clean up), the interface name is appended
+#define HANDOVER_SOCKET_PREFIX "eitn30arq-"
+#define HANDOVER_MAGIC 0x41525148  // "ARQH"
+// must change whenever HandoverState changes, a new process that gets another version only takes the fd over
+#define HANDOVER_VERSION 6
+#define HANDOVER_REASSEMBLY_SIZE 2048
+// for how long the old process waits for its threads to park, and the new one for the state
+#define HANDOVER_TIMEOUT_MS 5000
+// threads that park, in the order they do it (the stages of the pipeline)
+#define HANDOVER_STAGES 4
+
+struct HandoverState {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t localEpoch;
+    uint32_t peerEpoch;
+    uint8_t established;
+    uint8_t sendingAltBool;
+    uint8_t receivingAltBool;
+    uint8_t sizeKnown;
+    uint8_t fragmentsReceived;
+    uint8_t fragmentsToReceive;
+    uint16_t currentPacketSize;
+    uint8_t receivePolicy;      // the policy the sender of the peer announced (arqPolicy.h)
+    uint8_t corruptPending;     // the packet being received failed its crc, the sender did not confirm yet
+    uint64_t sealCounter;       // of the sealed packets (linkCrypto.h)
+    uint64_t openHighest[LINK_CHANNEL_COUNT];   // per channel, the fast path has its own window
+    uint64_t openWindow[LINK_CHANNEL_COUNT];
+    uint32_t openEpoch;
+    uint32_t retiredEpochs[LINK_CRYPTO_RETIRED];
+    uint8_t fragments[64];      // per seq state of the receiver (fragmentStatus)
+    uint8_t reassembly[HANDOVER_REASSEMBLY_SIZE];
+};
+
+class HotRestart {
+public:
+    HotRestart() : resumed(false), pauseRequested(false), listenFd(-1), tunFd(-1) {
+        memset(&state, 0, sizeof(state));
+        for(int i = 0; i < HANDOVER_STAGES; ++i) {
+            parked[i].store(false);
+        }
+    }
+
+    // ---- new process ----
+
+    // asks the running process for its tun fd and state, returns false if there is none (then we start from scratch)
+    bool takeOver(const char* ifname, int& fd) {
+        int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if(sock < 0) {
+            perror("Failed to open handover socket");
+            return false;
+        }
+        struct sockaddr_un address;
+        socklen_t addressLength = makeAddress(ifname, address);
+        if(connect(sock, reinterpret_cast<struct sockaddr*>(&address), addressLength) < 0) {
+            LOG_INFO(LOG_MAIN, "No running process to take over from (errno = {}), starting fresh", errno);
+            close(sock);
+            return false;
+        }
+        struct timeval timeout;
+        timeout.tv_sec = HANDOVER_TIMEOUT_MS / 1000;
+        timeout.tv_usec = (HANDOVER_TIMEOUT_MS % 1000) * 1000;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        uint8_t request = 1;
+        if(send(sock, &request, 1, 0) != 1) {
+            close(sock);
+            return false;
+        }
+        fd = receiveState(sock);
+        if(fd < 0) {
+            close(sock);
+            return false;
+        }
+        // the old process exits right after sending, its end of the socket is closed once it is gone (and the radios free)
+        char eof;
+        while(recv(sock, &eof, 1, 0) > 0) {
+        }
+        close(sock);
+        if(state.magic == HANDOVER_MAGIC && state.version == HANDOVER_VERSION) {
+            resumed = true;
+            // same epoch -> the peer does not notice the restart
+            session().localEpoch = state.localEpoch;
+            session().peerEpoch.store(state.peerEpoch);
+            session().established.store(state.established != 0);
+            linkCrypto().resume(state.sealCounter, state.localEpoch, state.openEpoch, state.openHighest, state.openWindow, state.retiredEpochs);
+            LOG_INFO(LOG_MAIN, "Took over tun fd and state, epoch {}, peer epoch {}", state.localEpoch, state.peerEpoch);
+        } else {
+            // only the fd is usable, the new epoch makes the peer resynchronize
+            LOG_WARN(LOG_MAIN, "Took over tun fd, but the state has version {} (ours is {}), starting a new session", state.version, HANDOVER_VERSION);
+        }
+        return true;
+    }
+
+    // ---- running process ----
+
+    // starts the thread that waits for a new process to take over
+    bool listen(const char* ifname, int fd) {
+        tunFd = fd;
+        listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        struct sockaddr_un address;
+        socklen_t addressLength = makeAddress(ifname, address);
+        // after a handover the name is freed only when the old process is completely gone
+        int bound = -1;
+        for(int waited = 0; listenFd >= 0 && waited < HANDOVER_TIMEOUT_MS; waited += 10) {
+            bound = bind(listenFd, reinterpret_cast<struct sockaddr*>(&address), addressLength);
+            if(bound == 0 || errno != EADDRINUSE) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if(bound < 0 || ::listen(listenFd, 1) < 0) {
+            LOG_ERROR(LOG_MAIN, "Failed to listen on the handover socket, errno = {}", errno);
+            return false;
+        }
+        std::thread(&HotRestart::serve, this).detach();
+        return true;
+    }
+
+    // true when the stage should park: a new process takes over and the stage before it is parked already (so the
+    // sender does not miss packets read by the tun reader, nor the receiver the acks of the last packet of the sender),
+    // a stage with an input queue parks only when it is empty
+    bool shouldPark(int stage) const {
+        return pauseRequested.load(std::memory_order_relaxed) && (stage == 0 || parked[stage - 1].load());
+    }
+
+    // the thread stays here while the handover is going on (the process exits at its end), and continues if it fails
+    void park(int stage) {
+        parked[stage].store(true);
+        while(pauseRequested.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        parked[stage].store(false);
+    }
+
+    HandoverState state;
+    // true if the state was taken over, the threads start from it instead of the initial values
+    bool resumed;
+
+private:
+    static socklen_t makeAddress(const char* ifname, struct sockaddr_un& address) {
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        // abstract socket: starts with a 0 byte
+        std::string name = std::string(HANDOVER_SOCKET_PREFIX) + ifname;
+        memcpy(address.sun_path + 1, name.data(), name.size());
+        return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + 1 + name.size());
+    }
+
+    int receiveState(int sock) {
+        struct iovec data;
+        data.iov_base = &state;
+        data.iov_len = sizeof(state);
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t length = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        if(length < 0 || header == NULL || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+            LOG_ERROR(LOG_MAIN, "Handover failed, no tun fd received (errno = {})", length < 0 ? errno : 0);
+            return -1;
+        }
+        int fd;
+        memcpy(&fd, CMSG_DATA(header), sizeof(fd));
+        if(static_cast<size_t>(length) != sizeof(state)) {
+            state.version = 0;
+        }
+        return fd;
+    }
+
+    bool sendState(int sock) {
+        struct iovec data;
+        data.iov_base = &state;
+        data.iov_len = sizeof(state);
+        char control[CMSG_SPACE(sizeof(int))];
+        memset(control, 0, sizeof(control));
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &tunFd, sizeof(tunFd));
+        return sendmsg(sock, &message, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(state));
+    }
+
+    bool waitParked() {
+        for(int waited = 0; waited < HANDOVER_TIMEOUT_MS; ++waited) {
+            if(parked[HANDOVER_STAGES - 1].load()) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+    void serve() {
+        while(true) {
+            int sock = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+            if(sock < 0) {
+                continue;
+            }
+            // only the same user (or root) may take the interface over
+            struct ucred peer;
+            socklen_t peerLength = sizeof(peer);
+            uint8_t request;
+            if(getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) < 0 || (peer.uid != 0 && peer.uid != getuid())
+               || recv(sock, &request, 1, 0) != 1) {
+                close(sock);
+                continue;
+            }
+            LOG_INFO(LOG_MAIN, "Process {} takes over, parking the sender and the receiver", peer.pid);
+            pauseRequested.store(true);
+            if(waitParked()) {
+                state.magic = HANDOVER_MAGIC;
+                state.version = HANDOVER_VERSION;
+                state.localEpoch = session().localEpoch;
+                state.peerEpoch = session().peerEpoch.load();
+                state.established = session().established.load() ? 1 : 0;
+                state.sealCounter = linkCrypto().sendCounter();
+                for(int channel = 0; channel < LINK_CHANNEL_COUNT; ++channel) {
+                    state.openHighest[channel] = linkCrypto().receiveHighest(static_cast<LinkChannel>(channel));
+                    state.openWindow[channel] = linkCrypto().receiveWindow(static_cast<LinkChannel>(channel));
+                }
+                state.openEpoch = linkCrypto().receiveEpoch();
+                memcpy(state.retiredEpochs, linkCrypto().retiredEpochs(), sizeof(state.retiredEpochs));
+                if(sendState(sock)) {
+                    LOG_INFO(LOG_MAIN, "Handed over to process {}, exiting", peer.pid);
+                    // no teardown, the interface, routes and nat stay for the new process
+                    frameCapture().stop();
+                    asyncLog().stop();
+                    _Exit(0);
+                }
+            }
+            LOG_WARN(LOG_MAIN, "Handover to process {} failed, continuing", peer.pid);
+            pauseRequested.store(false);
+            close(sock);
+        }
+    }
+
+    std::atomic<bool> pauseRequested;
+    std::atomic<bool> parked[HANDOVER_STAGES];
+    int listenFd;
+    int tunFd;
+};
+
+// the one hot restart of the program
+inline HotRestart& hotRestart() {
+    static HotRestart instance;
+    return instance;
+}
+
+#endif
@@ -0,0 +1,377 @@
+#ifndef LINK_CRYPTO_H
+#define LINK_CRYPTO_H
+
+// Sealed ip packets (--psk): without it anyone with an nRF24 on our channels can send frames the receiver acknowledges
+// and writes to tun0. With a pre-shared key the sender seals every ip packet with ChaCha20-Poly1305 (chachaPoly.h)
+// before it is framed, and the tun writer opens it after the reassembly, so the 16 byte tag costs once per ip packet
+// and not per frame, and the radio threads do no crypto.
+// - keys: one per direction and session, HChaCha20 of the pre-shared key and the epochs of the two stations (the
+//   epoch of a run is random, see session.h), so a restart of either station changes both keys
+// - nonce: a 64 bit counter of the sender, never reset while the program runs (nor by a hot restart), so a nonce is
+//   never used twice with a key, even when a forged HELLO brings an old epoch of the peer back
+// - replays: the receiver accepts a counter only once (a window of the last 64 below the highest one), the epochs the
+//   peer had before are refused, so the packets of an older session can not be replayed either
+// - epochs: the receiver moves to a new epoch of the peer only with a packet that authenticates under it, the epoch in
+//   a HELLO is not authenticated
+// - channels: the packets of the fast path (fastPath.h) overtake the ones of the ARQ, they are sealed by the tun reader
+//   with the same counter and bit 63 set, and the receiver keeps a window per channel
+// sealed packet: [first 4 bytes of the ip header, with the total length of the sealed packet][rest of the ip packet,
+//                 encrypted][counter (8 bytes)][tag (16 bytes)]
+// The first 4 bytes stay readable, the receiver takes the size from them (see packetSizeOf), they and the counter are
+// the associated data of the tag.
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include "chachaPoly.h"
+#include "asyncLog.h"
+
+#define LINK_CRYPTO_CLEAR 4
+#define LINK_CRYPTO_COUNTER_SIZE 8
+#define LINK_CRYPTO_OVERHEAD (LINK_CRYPTO_COUNTER_SIZE + POLY1305_TAG_SIZE)
+#define LINK_CRYPTO_AAD_SIZE (LINK_CRYPTO_CLEAR + LINK_CRYPTO_COUNTER_SIZE)
+// the smallest sealed packet, of a 20 byte ip header
+#define LINK_CRYPTO_MIN_SEALED (20 + LINK_CRYPTO_OVERHEAD)
+// earlier epochs of the peer that are refused
+#define LINK_CRYPTO_RETIRED 8
+// separates the keys of the link from other uses of the pre-shared key
+#define LINK_CRYPTO_LABEL "arq-link"
+// the counter bit of the packets sent on the fast path
+#define LINK_CRYPTO_FAST_BIT (1ULL << 63)
+
+// the packets of a channel arrive in order (more or less), the two channels not
+enum LinkChannel {
+    LINK_CHANNEL_ARQ,
+    LINK_CHANNEL_FAST,
+    LINK_CHANNEL_COUNT
+};
+
+inline uint64_t loadLe64(const uint8_t* p) {
+    return loadLe32(p) | (static_cast<uint64_t>(loadLe32(p + 4)) << 32);
+}
+
+class LinkCrypto {
+public:
+    LinkCrypto() : enabled(false), sealed(0), opened(0), authFailures(0), replays(0), refusedEpochs(0), txCounter(0), rxEpoch(0),
+                   retiredNext(0), candidateEpoch(0) {
+        memset(psk, 0, sizeof(psk));
+        memset(retired, 0, sizeof(retired));
+        for(int channel = 0; channel < LINK_CHANNEL_COUNT; ++channel) {
+            txEpoch[channel] = 0;
+            rxHighest[channel] = 0;
+            rxWindow[channel] = 0;
+        }
+    }
+
+    // the pre-shared key, 64 hex digits in a file (e.g. head -c 32 /dev/urandom | xxd -p -c 32 > arq.key)
+    bool loadKey(const char* path) {
+        FILE* file = fopen(path, "r");
+        if(file == NULL) {
+            perror("Failed to open the key file");
+            return false;
+        }
+        struct stat info;
+        if(fstat(fileno(file), &info) == 0 && (info.st_mode & 0077) != 0) {
+            fprintf(stderr, "Warning: the key file %s can be read by other users\n", path);
+        }
+        int digits = 0;
+        int c;
+        while((c = fgetc(file)) != EOF && digits <= 2 * CHACHA_KEY_SIZE) {
+            if(isspace(c)) {
+                continue;
+            }
+            if(!isxdigit(c) || digits == 2 * CHACHA_KEY_SIZE) {
+                digits = -1;
+                break;
+            }
+            int value = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+            psk[digits / 2] = static_cast<uint8_t>(digits % 2 == 0 ? value << 4 : psk[digits / 2] | value);
+            ++digits;
+        }
+        fclose(file);
+        if(digits != 2 * CHACHA_KEY_SIZE) {
+            fprintf(stderr, "The key file %s must hold %d hex digits\n", path, 2 * CHACHA_KEY_SIZE);
+            return false;
+        }
+        enabled = true;
+        return true;
+    }
+
+    // ---- sender thread (LINK_CHANNEL_ARQ), tun reader thread (LINK_CHANNEL_FAST) ----
+
+    // seals the ip packet in place, there must be LINK_CRYPTO_OVERHEAD bytes of room behind it
+    void seal(uint8_t* data, uint16_t& length, uint32_t localEpoch, uint32_t peerEpoch, LinkChannel channel) {
+        if(peerEpoch != txEpoch[channel]) {
+            deriveKey(localEpoch, peerEpoch, txKey[channel]);
+            txEpoch[channel] = peerEpoch;
+        }
+        uint16_t sealedLength = static_cast<uint16_t>(length + LINK_CRYPTO_OVERHEAD);
+        data[2] = static_cast<uint8_t>(sealedLength >> 8);
+        data[3] = static_cast<uint8_t>(sealedLength);
+        uint8_t* counter = data + length;
+        uint64_t sequence = txCounter.fetch_add(1, std::memory_order_relaxed) + 1;
+        storeLe64(counter, channel == LINK_CHANNEL_FAST ? sequence | LINK_CRYPTO_FAST_BIT : sequence);
+        uint8_t nonce[CHACHA_NONCE_SIZE];
+        uint8_t aad[LINK_CRYPTO_AAD_SIZE];
+        makeNonce(counter, nonce, data, aad);
+        chachaPolySeal(txKey[channel], nonce, aad, LINK_CRYPTO_AAD_SIZE, data + LINK_CRYPTO_CLEAR, length - LINK_CRYPTO_CLEAR,
+                       counter + LINK_CRYPTO_COUNTER_SIZE);
+        length = sealedLength;
+        sealed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // ---- tun writer thread ----
+
+    // checks and decrypts a sealed packet in place, false if it is forged, corrupted or a replay
+    bool open(uint8_t* data, uint16_t& length, uint32_t localEpoch, uint32_t peerEpoch) {
+        if(length < LINK_CRYPTO_MIN_SEALED || peerEpoch == 0) {
+            authFailures.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        uint16_t plainLength = static_cast<uint16_t>(length - LINK_CRYPTO_OVERHEAD);
+        const uint8_t* counter = data + plainLength;
+        uint64_t sequence = loadLe64(counter);
+        int channel = (sequence & LINK_CRYPTO_FAST_BIT) != 0 ? LINK_CHANNEL_FAST : LINK_CHANNEL_ARQ;
+        sequence &= ~LINK_CRYPTO_FAST_BIT;
+        uint8_t nonce[CHACHA_NONCE_SIZE];
+        uint8_t aad[LINK_CRYPTO_AAD_SIZE];
+        makeNonce(counter, nonce, data, aad);
+        // the session took another epoch of the peer from a HELLO or KEEPALIVE, which are not authenticated: the epoch
+        // changes with the first packet that authenticates under it, until then the current one keeps its windows and
+        // its packets still open, so a forged HELLO costs the packets it overlaps and not the session
+        bool refused = false;
+        if(peerEpoch != rxEpoch) {
+            if(isRetired(peerEpoch)) {
+                refused = true;
+            } else if(sequence != 0 && chachaPolyOpen(candidateKey(localEpoch, peerEpoch), nonce, aad, LINK_CRYPTO_AAD_SIZE,
+                                                      data + LINK_CRYPTO_CLEAR, plainLength - LINK_CRYPTO_CLEAR,
+                                                      counter + LINK_CRYPTO_COUNTER_SIZE)) {
+                changePeerEpoch(peerEpoch);
+                return finishOpen(data, length, plainLength, channel, sequence);
+            }
+        }
+        // cheap to tell before the tag, but the window moves only for an authentic packet
+        if(rxEpoch != 0 && !fresh(channel, sequence)) {
+            replays.fetch_add(1, std::memory_order_relaxed);
+            LOG_DEBUG(LOG_RECEIVE, "Dropped a replayed sealed packet, counter {}, highest {}", sequence, rxHighest[channel]);
+            return false;
+        }
+        if(rxEpoch == 0 || !chachaPolyOpen(rxKey, nonce, aad, LINK_CRYPTO_AAD_SIZE, data + LINK_CRYPTO_CLEAR, plainLength - LINK_CRYPTO_CLEAR,
+                                           counter + LINK_CRYPTO_COUNTER_SIZE)) {
+            if(refused) {
+                refusedEpochs.fetch_add(1, std::memory_order_relaxed);
+                LOG_WARN(LOG_RECEIVE, "Refused a packet under the earlier peer epoch {} (replayed hello?)", peerEpoch);
+            } else {
+                authFailures.fetch_add(1, std::memory_order_relaxed);
+                LOG_WARN(LOG_RECEIVE, "Dropped a packet of {} bytes that failed authentication, failed so far: {}", length, authFailures.load());
+            }
+            return false;
+        }
+        return finishOpen(data, length, plainLength, channel, sequence);
+    }
+
+    // ---- hot restart, while the threads are parked / before they start ----
+
+    uint64_t sendCounter() const { return txCounter.load(); }
+    uint32_t receiveEpoch() const { return rxEpoch; }
+    uint64_t receiveHighest(LinkChannel channel) const { return rxHighest[channel]; }
+    uint64_t receiveWindow(LinkChannel channel) const { return rxWindow[channel]; }
+    const uint32_t* retiredEpochs() const { return retired; }
+
+    void resume(uint64_t counter, uint32_t localEpoch, uint32_t epoch, const uint64_t* highest, const uint64_t* window, const uint32_t* retiredEpochs) {
+        txCounter.store(counter);
+        rxEpoch = epoch;
+        for(int channel = 0; channel < LINK_CHANNEL_COUNT; ++channel) {
+            rxHighest[channel] = highest[channel];
+            rxWindow[channel] = window[channel];
+        }
+        memcpy(retired, retiredEpochs, sizeof(retired));
+        if(enabled && epoch != 0) {
+            deriveKey(epoch, localEpoch, rxKey);
+        }
+    }
+
+    bool enabled;   // set before the threads start
+
+    // statistics
+    std::atomic<uint64_t> sealed;
+    std::atomic<uint64_t> opened;
+    std::atomic<uint64_t> authFailures;
+    std::atomic<uint64_t> replays;
+    std::atomic<uint64_t> refusedEpochs;    // packets under an epoch the peer had before
+
+private:
+    void deriveKey(uint32_t senderEpoch, uint32_t receiverEpoch, ChaChaKey& key) const {
+        uint8_t input[16];
+        storeLe32(input, senderEpoch);
+        storeLe32(input + 4, receiverEpoch);
+        memcpy(input + 8, LINK_CRYPTO_LABEL, 8);
+        uint8_t subkey[CHACHA_KEY_SIZE];
+        hchacha20(psk, input, subkey);
+        key.load(subkey);
+    }
+
+    static void makeNonce(const uint8_t* counter, uint8_t nonce[CHACHA_NONCE_SIZE], const uint8_t* data, uint8_t aad[LINK_CRYPTO_AAD_SIZE]) {
+        memset(nonce, 0, CHACHA_NONCE_SIZE - LINK_CRYPTO_COUNTER_SIZE);
+        memcpy(nonce + CHACHA_NONCE_SIZE - LINK_CRYPTO_COUNTER_SIZE, counter, LINK_CRYPTO_COUNTER_SIZE);
+        memcpy(aad, data, LINK_CRYPTO_CLEAR);
+        memcpy(aad + LINK_CRYPTO_CLEAR, counter, LINK_CRYPTO_COUNTER_SIZE);
+    }
+
+    bool isRetired(uint32_t peerEpoch) const {
+        for(int i = 0; i < LINK_CRYPTO_RETIRED; ++i) {
+            if(retired[i] == peerEpoch) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the key of the epoch the session names, derived once and not for every packet that fails under it
+    const ChaChaKey& candidateKey(uint32_t localEpoch, uint32_t peerEpoch) {
+        if(candidateEpoch != peerEpoch) {
+            deriveKey(peerEpoch, localEpoch, candidate);
+            candidateEpoch = peerEpoch;
+        }
+        return candidate;
+    }
+
+    // a packet authenticated under the candidate epoch, the peer restarted: its key and a new window. The epoch before
+    // had authenticated packets too (an epoch becomes the current one only so), from now on it is refused.
+    void changePeerEpoch(uint32_t peerEpoch) {
+        if(rxEpoch != 0) {
+            retired[retiredNext] = rxEpoch;
+            retiredNext = (retiredNext + 1) % LINK_CRYPTO_RETIRED;
+        }
+        rxKey = candidate;
+        rxEpoch = peerEpoch;
+        for(int channel = 0; channel < LINK_CHANNEL_COUNT; ++channel) {
+            rxHighest[channel] = 0;
+            rxWindow[channel] = 0;
+        }
+    }
+
+    // the packet is authentic: its counter is used, the header gets the length of the plain packet
+    bool finishOpen(uint8_t* data, uint16_t& length, uint16_t plainLength, int channel, uint64_t sequence) {
+        accept(channel, sequence);
+        data[2] = static_cast<uint8_t>(plainLength >> 8);
+        data[3] = static_cast<uint8_t>(plainLength);
+        length = plainLength;
+        opened.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool fresh(int channel, uint64_t sequence) const {
+        if(sequence == 0) {
+            return false;
+        }
+        if(sequence > rxHighest[channel]) {
+            return true;
+        }
+        uint64_t age = rxHighest[channel] - sequence;
+        return age < 64 && (rxWindow[channel] & (1ULL << age)) == 0;
+    }
+
+    // bit i of the window is the counter rxHighest - i
+    void accept(int channel, uint64_t sequence) {
+        if(sequence > rxHighest[channel]) {
+            uint64_t shift = sequence - rxHighest[channel];
+            rxWindow[channel] = shift < 64 ? (rxWindow[channel] << shift) | 1 : 1;
+            rxHighest[channel] = sequence;
+        } else {
+            rxWindow[channel] |= 1ULL << (rxHighest[channel] - sequence);
+        }
+    }
+
+    uint8_t psk[CHACHA_KEY_SIZE];
+    // a key per sending thread, the counter is shared
+    ChaChaKey txKey[LINK_CHANNEL_COUNT];
+    uint32_t txEpoch[LINK_CHANNEL_COUNT];
+    std::atomic<uint64_t> txCounter;
+    // tun writer thread
+    ChaChaKey rxKey;
+    uint32_t rxEpoch;
+    uint64_t rxHighest[LINK_CHANNEL_COUNT];
+    uint64_t rxWindow[LINK_CHANNEL_COUNT];
+    uint32_t retired[LINK_CRYPTO_RETIRED];
+    int retiredNext;
+    // the epoch of the session, not yet authenticated by a packet
+    ChaChaKey candidate;
+    uint32_t candidateEpoch;
+};
+
+// the one key of the link
+inline LinkCrypto& linkCrypto() {
+    static LinkCrypto instance;
+    return instance;
+}
+
+// the AEAD test vector of RFC 8439 (section 2.8.2), checked before the first packet is sealed
+inline bool chachaPolySelfTest() {
+    const char* text = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+    static const uint8_t nonce[CHACHA_NONCE_SIZE] = {0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47};
+    static const uint8_t aad[12] = {0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7};
+    static const uint8_t expectedTag[POLY1305_TAG_SIZE] = {0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb,
+                                                           0xd0, 0x60, 0x06, 0x91};
+    static const uint8_t expectedStart[16] = {0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef,
+                                              0x7e, 0xc2};
+    uint8_t keyBytes[CHACHA_KEY_SIZE];
+    for(int i = 0; i < CHACHA_KEY_SIZE; ++i) {
+        keyBytes[i] = static_cast<uint8_t>(0x80 + i);
+    }
+    ChaChaKey key;
+    key.load(keyBytes);
+    size_t length = strlen(text);
+    uint8_t data[128];
+    memcpy(data, text, length);
+    uint8_t tag[POLY1305_TAG_SIZE];
+    chachaPolySeal(key, nonce, aad, sizeof(aad), data, length, tag);
+    if(memcmp(tag, expectedTag, sizeof(tag)) != 0 || memcmp(data, expectedStart, sizeof(expectedStart)) != 0) {
+        return false;
+    }
+    return chachaPolyOpen(key, nonce, aad, sizeof(aad), data, length, tag) && memcmp(data, text, length) == 0;
+}
+
+// --crypto-bench: seals and opens packets as fast as it can, to compare with the rate of the link
+inline int linkCryptoBenchmark() {
+    if(!chachaPolySelfTest()) {
+        printf("ChaCha20-Poly1305 (%s) fails the test vector of RFC 8439\n", CHACHA_SIMD);
+        return 1;
+    }
+    printf("ChaCha20-Poly1305 (%s) passes the test vector of RFC 8439\n", CHACHA_SIMD);
+    LinkCrypto sender;
+    LinkCrypto receiver;
+    sender.enabled = receiver.enabled = true;
+    static const int sizes[3] = {64, 576, 1500};
+    for(int s = 0; s < 3; ++s) {
+        uint8_t packet[1500 + LINK_CRYPTO_OVERHEAD];
+        memset(packet, 0, sizeof(packet));
+        packet[0] = 0x45;
+        uint64_t packets = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        double seconds = 0;
+        while(seconds < 1) {
+            for(int i = 0; i < 256; ++i) {
+                uint16_t length = static_cast<uint16_t>(sizes[s]);
+                sender.seal(packet, length, 1, 2, LINK_CHANNEL_ARQ);
+                if(!receiver.open(packet, length, 2, 1)) {
+                    printf("A sealed packet did not open\n");
+                    return 1;
+                }
+            }
+            packets += 256;
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        double rate = packets * sizes[s] / seconds;
+        // 2 Mbit/s on air is the most the radios can carry, headers and gaps between the frames not even counted
+        printf("%4d byte packets: %8.0f packets/s sealed and opened, %7.1f MB/s, %6.0f times the 2 Mbit/s air rate, %.2f us per packet\n",
+               sizes[s], packets / seconds, rate / 1e6, rate * 8 / 2e6, seconds * 1e6 / packets);
+    }
+    return 0;
+}
+
+#endif
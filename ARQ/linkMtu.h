@@ -0,0 +1,149 @@
+#ifndef LINK_MTU_H
+#define LINK_MTU_H
+
+// MTU of tun0 in whole fragments, adapted to the loss of the link.
+// With the default 1500 a packet takes 49 fragments, the last one carrying 12 bytes. We set the mtu to a whole number
+// of fragments and pick the number that moves the most ip payload per frame on air:
+// - per packet the 40 bytes of ip / tcp headers and the last fragment (only partly filled with other sizes) are
+//   overhead, which favours large packets
+// - every fragment is lost with the measured probability p, the resend rounds of a packet grow with its fragments
+//   (each round costs the 1 ms ack wait) and a packet still incomplete when its retry budget ends is lost entirely,
+//   which stalls tcp for a retransmission timeout
+// The loss is measured from the resends of the sender, every LINK_MTU_INTERVAL_MS the mtu is chosen again and changed
+// when the new one is clearly better. The base station clamps the mss of the tcp connections to it (netConfig.h).
+// The crc of the packet and the seal (--psk) take room in the fragments, the mtu of tun0 is that much smaller.
+
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <stdint.h>
+#include "netConfig.h"
+#include "trafficClass.h"
+#include "crc32c.h"
+#include "asyncLog.h"
+
+#define LINK_MTU_MAX 1500       // the uplink of the base station
+#define LINK_MTU_MIN 576
+#define LINK_MTU_HEADERS 40     // ip and tcp header
+#define LINK_MTU_INTERVAL_MS 2000
+// fewer frames sent since the last look are not enough to tell the loss
+#define LINK_MTU_MIN_SAMPLES 200
+// a frame on air (32 bytes at 2 Mbit/s with the radio overhead and the SPI upload)
+#define LINK_MTU_FRAME_US 200
+// the 1 ms ack wait of a resend round in frames on air
+#define LINK_MTU_ROUND_FRAMES 5
+// a packet dropped at the end of its retry budget, the 200 ms minimal retransmission timeout of tcp in frames on air
+#define LINK_MTU_DROP_FRAMES 1000
+// the new mtu must be this much better, so the mtu does not flap
+#define LINK_MTU_HYSTERESIS 0.03
+
+class LinkMtu {
+public:
+    LinkMtu() : fixedMtu(0), overhead(CRC32C_SIZE), mtu(0), sent(0), resent(0), ifname(NULL), baseStation(false), payload(31), loss(0) {}
+
+    // the sender calls this for every packet: frames sent the first time and frames resent
+    void record(int frames, int resends) {
+        sent.fetch_add(frames, std::memory_order_relaxed);
+        resent.fetch_add(resends, std::memory_order_relaxed);
+    }
+
+    // sets the mtu of the interface (and the mss clamp of the base station) and starts adapting it
+    bool start(const char* name, bool base, int fragmentPayload) {
+        ifname = name;
+        baseStation = base;
+        payload = fragmentPayload;
+        int initial = fixedMtu > 0 ? fixedMtu + overhead : best(0);
+        if(!apply(initial)) {
+            return false;
+        }
+        if(fixedMtu == 0) {
+            std::thread(&LinkMtu::run, this).detach();
+        }
+        return true;
+    }
+
+    // expected ip payload per frame on air of packets with the given fragments
+    double efficiency(int fragments, double p) const {
+        // the retry budget, or the rounds that fit into the lifetime after the first send (a round is the ack wait and
+        // the airtime of the fragments resent), whichever ends first
+        const ClassLimits& limits = trafficPolicy().limits[CLASS_TCP];
+        double lifetimeUs = limits.lifetimeMs * 1000.0 - fragments * LINK_MTU_FRAME_US;
+        double roundUs = (LINK_MTU_ROUND_FRAMES + fragments * p) * LINK_MTU_FRAME_US;
+        int maxRounds = lifetimeUs > 0 ? static_cast<int>(std::min<double>(limits.maxResendRounds, lifetimeUs / roundUs)) : 0;
+        // rounds until every fragment got through
+        double rounds = 0;
+        double lostAgain = p;
+        for(int round = 1; round <= maxRounds && lostAgain > 1e-9; ++round, lostAgain *= p) {
+            rounds += 1 - std::pow(1 - lostAgain, fragments);
+        }
+        double delivered = std::pow(1 - std::pow(p, maxRounds + 1), fragments);
+        double frames = fragments / (1 - p) + rounds * LINK_MTU_ROUND_FRAMES + (1 - delivered) * LINK_MTU_DROP_FRAMES;
+        return delivered * (fragments * payload - overhead - LINK_MTU_HEADERS) / frames;
+    }
+
+    // the mtu (whole fragments) with the best efficiency
+    int best(double p) const {
+        int bestFragments = LINK_MTU_MAX / payload;
+        for(int fragments = bestFragments; fragments * payload >= LINK_MTU_MIN; --fragments) {
+            if(efficiency(fragments, p) > efficiency(bestFragments, p)) {
+                bestFragments = fragments;
+            }
+        }
+        return bestFragments * payload;
+    }
+
+    int fixedMtu;   // --mtu, 0 = adapt to the loss
+    int overhead;   // bytes added to every ip packet on the link, set before start
+    std::atomic<int> mtu;   // bytes of the fragments of the largest packet
+
+private:
+    void run() {
+        uint64_t lastSent = sent.load();
+        uint64_t lastResent = resent.load();
+        while(true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(LINK_MTU_INTERVAL_MS));
+            uint64_t nowSent = sent.load(std::memory_order_relaxed);
+            uint64_t nowResent = resent.load(std::memory_order_relaxed);
+            uint64_t frames = (nowSent - lastSent) + (nowResent - lastResent);
+            if(frames < LINK_MTU_MIN_SAMPLES) {
+                continue;
+            }
+            // every lost frame is resent once (the last loss of an abandoned packet aside)
+            double measured = static_cast<double>(nowResent - lastResent) / frames;
+            lastSent = nowSent;
+            lastResent = nowResent;
+            loss = 0.5 * loss + 0.5 * std::min(measured, 0.95);
+            int candidate = best(loss);
+            int current = mtu.load();
+            if(candidate != current && efficiency(candidate / payload, loss) > (1 + LINK_MTU_HYSTERESIS) * efficiency(current / payload, loss)) {
+                LOG_INFO(LOG_MAIN, "Loss {} per mille, mtu of the tun interface {} -> {}", static_cast<int>(loss * 1000), current - overhead, candidate - overhead);
+                apply(candidate);
+            }
+        }
+    }
+
+    bool apply(int value) {
+        if(!setLinkUp(ifname, value - overhead)) {
+            return false;
+        }
+        mtu.store(value);
+        return !baseStation || setMssClamp(ifname, static_cast<uint16_t>(value - overhead - LINK_MTU_HEADERS));
+    }
+
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> resent;
+    const char* ifname;
+    bool baseStation;
+    int payload;
+    double loss;
+};
+
+// the one mtu of tun0
+inline LinkMtu& linkMtu() {
+    static LinkMtu instance;
+    return instance;
+}
+
+#endif
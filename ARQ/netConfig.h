@@ -0,0 +1,630 @@
+#ifndef NET_CONFIG_H
+#define NET_CONFIG_H
+
+// Configuration of the tun interface, routes and NAT directly over netlink, instead of forking "ip" and "iptables".
+// Everything is idempotent, so a restart after a crash finds nothing in its way and leaves no duplicates behind:
+// - address and routes are added with NLM_F_REPLACE
+// - NAT and forwarding rules live in their own nftables table, which is (re)created in one atomic batch
+//   (add table, delete table, add table with chains and rules) and deleted again on exit
+
+#include <vector>
+#include <string>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+#include "asyncLog.h"
+
+// name of our nftables table
+#define NFT_TABLE_NAME "eitn30"
+// from linux/netfilter.h, which can not be included next to netinet/in.h
+#define NFT_PROTO_IPV4 2
+#define NFT_HOOK_PRE_ROUTING 0
+#define NFT_HOOK_FORWARD 2
+#define NFT_HOOK_LOCAL_OUT 3
+#define NFT_HOOK_POST_ROUTING 4
+#define NFT_VERDICT_ACCEPT 1
+// conntrack state bits as nftables sees them (ct state established,related)
+#define NFT_CT_STATE_ESTABLISHED 0x02
+#define NFT_CT_STATE_RELATED 0x04
+
+// builds one or more netlink messages (with attributes) in one buffer
+class NetlinkBuffer {
+public:
+    NetlinkBuffer() : messageStart(0), messages(0) {}
+
+    void beginMessage(uint16_t type, uint16_t flags, uint32_t seq) {
+        messageStart = data.size();
+        struct nlmsghdr header;
+        memset(&header, 0, sizeof(header));
+        header.nlmsg_type = type;
+        header.nlmsg_flags = flags;
+        header.nlmsg_seq = seq;
+        append(&header, sizeof(header));
+        ++messages;
+    }
+
+    // the fixed header of the protocol (ifinfomsg, ifaddrmsg, rtmsg, nfgenmsg)
+    template <typename T>
+    void putHeader(const T& header) {
+        append(&header, sizeof(header));
+    }
+
+    void putAttr(uint16_t type, const void* payload, size_t length) {
+        struct nlattr attr;
+        attr.nla_type = type;
+        attr.nla_len = static_cast<uint16_t>(NLA_HDRLEN + length);
+        append(&attr, sizeof(attr));
+        append(payload, length);
+    }
+
+    void putString(uint16_t type, const char* text) {
+        putAttr(type, text, strlen(text) + 1);
+    }
+
+    void putU32(uint16_t type, uint32_t value) {
+        putAttr(type, &value, sizeof(value));
+    }
+
+    // nftables wants its numbers in network byte order
+    void putU32Be(uint16_t type, uint32_t value) {
+        putU32(type, htonl(value));
+    }
+
+    size_t beginNested(uint16_t type) {
+        size_t start = data.size();
+        putAttr(type | NLA_F_NESTED, NULL, 0);
+        return start;
+    }
+
+    void endNested(size_t start) {
+        reinterpret_cast<struct nlattr*>(&data[start])->nla_len = static_cast<uint16_t>(data.size() - start);
+    }
+
+    void endMessage() {
+        reinterpret_cast<struct nlmsghdr*>(&data[messageStart])->nlmsg_len = static_cast<uint32_t>(data.size() - messageStart);
+    }
+
+    const uint8_t* bytes() const {
+        return data.data();
+    }
+
+    size_t size() const {
+        return data.size();
+    }
+
+private:
+    void append(const void* bytes, size_t length) {
+        size_t offset = data.size();
+        // every header and attribute starts 4 byte aligned
+        data.resize(offset + NLA_ALIGN(length), 0);
+        if(length != 0) {
+            memcpy(&data[offset], bytes, length);
+        }
+    }
+
+    std::vector<uint8_t> data;
+    size_t messageStart;
+    int messages;
+};
+
+class Netlink {
+public:
+    explicit Netlink(int protocol) : seq(1) {
+        fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+        if(fd < 0) {
+            perror("Failed to open netlink socket");
+        }
+    }
+
+    ~Netlink() {
+        if(fd >= 0) {
+            close(fd);
+        }
+    }
+
+    uint32_t nextSeq() {
+        return seq++;
+    }
+
+    // sends the messages and waits for the acknowledgements of expectedAcks of them, returns 0 or -errno of the first error
+    int transact(const NetlinkBuffer& buffer, int expectedAcks) {
+        if(fd < 0) {
+            return -EBADF;
+        }
+        struct sockaddr_nl kernel;
+        memset(&kernel, 0, sizeof(kernel));
+        kernel.nl_family = AF_NETLINK;
+        if(sendto(fd, buffer.bytes(), buffer.size(), 0, reinterpret_cast<struct sockaddr*>(&kernel), sizeof(kernel)) < 0) {
+            return -errno;
+        }
+        int result = 0;
+        char reply[8192];
+        while(expectedAcks > 0) {
+            ssize_t length = recv(fd, reply, sizeof(reply), 0);
+            if(length < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                return -errno;
+            }
+            for(struct nlmsghdr* header = reinterpret_cast<struct nlmsghdr*>(reply); NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+                if(header->nlmsg_type == NLMSG_ERROR) {
+                    struct nlmsgerr* error = static_cast<struct nlmsgerr*>(NLMSG_DATA(header));
+                    if(error->error != 0 && result == 0) {
+                        result = error->error;
+                    }
+                    --expectedAcks;
+                    // a failed batch is answered with only the error
+                    if(error->error != 0) {
+                        expectedAcks = 0;
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+private:
+    int fd;
+    uint32_t seq;
+};
+
+// ---------------------------------------------------------------------------------------------------------
+// rtnetlink: link, address and routes
+
+// index of the interface, 0 if there is none (net/if.h with if_nametoindex does not go together with linux/if.h)
+inline int interfaceIndex(const char* ifname) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return 0;
+    }
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    int index = ioctl(fd, SIOCGIFINDEX, &ifr) < 0 ? 0 : ifr.ifr_ifindex;
+    close(fd);
+    return index;
+}
+
+// sets the mtu (0 = keep) and brings the interface up
+inline bool setLinkUp(const char* ifname, int mtu) {
+    Netlink netlink(NETLINK_ROUTE);
+    NetlinkBuffer buffer;
+    buffer.beginMessage(RTM_NEWLINK, NLM_F_REQUEST | NLM_F_ACK, netlink.nextSeq());
+    struct ifinfomsg info;
+    memset(&info, 0, sizeof(info));
+    info.ifi_family = AF_UNSPEC;
+    info.ifi_index = interfaceIndex(ifname);
+    info.ifi_flags = IFF_UP;
+    info.ifi_change = IFF_UP;
+    buffer.putHeader(info);
+    if(mtu > 0) {
+        buffer.putU32(IFLA_MTU, static_cast<uint32_t>(mtu));
+    }
+    buffer.endMessage();
+    int error = info.ifi_index == 0 ? -ENODEV : netlink.transact(buffer, 1);
+    if(error != 0) {
+        LOG_ERROR(LOG_MAIN, "Failed to set the interface up (mtu {}), errno = {}", mtu, -error);
+        return false;
+    }
+    return true;
+}
+
+// assigns address/prefix to the interface, replacing it if it is already there
+inline bool setAddress(const char* ifname, const char* address, int prefixLength) {
+    Netlink netlink(NETLINK_ROUTE);
+    NetlinkBuffer buffer;
+    buffer.beginMessage(RTM_NEWADDR, NLM_F_REQUEST | NLM_F_ACK | NLM_F_CREATE | NLM_F_REPLACE, netlink.nextSeq());
+    struct ifaddrmsg info;
+    memset(&info, 0, sizeof(info));
+    info.ifa_family = AF_INET;
+    info.ifa_prefixlen = static_cast<unsigned char>(prefixLength);
+    info.ifa_index = static_cast<uint32_t>(interfaceIndex(ifname));
+    buffer.putHeader(info);
+    struct in_addr ip;
+    if(inet_pton(AF_INET, address, &ip) != 1) {
+        return false;
+    }
+    buffer.putAttr(IFA_LOCAL, &ip, sizeof(ip));
+    buffer.putAttr(IFA_ADDRESS, &ip, sizeof(ip));
+    buffer.endMessage();
+    int error = info.ifa_index == 0 ? -ENODEV : netlink.transact(buffer, 1);
+    if(error != 0) {
+        LOG_ERROR(LOG_MAIN, "Failed to assign the address, errno = {}", -error);
+        return false;
+    }
+    return true;
+}
+
+// adds (or replaces) / deletes the default route via gateway on the interface
+inline bool setDefaultRoute(const char* ifname, const char* gateway, bool add) {
+    Netlink netlink(NETLINK_ROUTE);
+    NetlinkBuffer buffer;
+    uint16_t flags = NLM_F_REQUEST | NLM_F_ACK;
+    if(add) {
+        flags |= NLM_F_CREATE | NLM_F_REPLACE;
+    }
+    buffer.beginMessage(add ? RTM_NEWROUTE : RTM_DELROUTE, flags, netlink.nextSeq());
+    struct rtmsg route;
+    memset(&route, 0, sizeof(route));
+    route.rtm_family = AF_INET;
+    route.rtm_dst_len = 0;
+    route.rtm_table = RT_TABLE_MAIN;
+    route.rtm_protocol = RTPROT_STATIC;
+    route.rtm_scope = RT_SCOPE_UNIVERSE;
+    route.rtm_type = RTN_UNICAST;
+    buffer.putHeader(route);
+    struct in_addr ip;
+    if(inet_pton(AF_INET, gateway, &ip) != 1) {
+        return false;
+    }
+    buffer.putAttr(RTA_GATEWAY, &ip, sizeof(ip));
+    buffer.putU32(RTA_OIF, static_cast<uint32_t>(interfaceIndex(ifname)));
+    buffer.endMessage();
+    int error = netlink.transact(buffer, 1);
+    // nothing to delete is fine as well
+    if(error != 0 && !(error == -ESRCH && !add)) {
+        LOG_ERROR(LOG_MAIN, "Failed to {} (1 = add, 0 = delete) the default route, errno = {}", add, -error);
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// nftables: NAT and forwarding of the base station
+
+class NftBatch {
+public:
+    explicit NftBatch(Netlink& netlink) : netlink(netlink), acks(0) {
+        batchMessage(NFNL_MSG_BATCH_BEGIN);
+    }
+
+    void addTable() {
+        begin(NFT_MSG_NEWTABLE, NLM_F_CREATE);
+        buffer.putString(NFTA_TABLE_NAME, NFT_TABLE_NAME);
+        buffer.endMessage();
+    }
+
+    void deleteTable() {
+        begin(NFT_MSG_DELTABLE, 0);
+        buffer.putString(NFTA_TABLE_NAME, NFT_TABLE_NAME);
+        buffer.endMessage();
+    }
+
+    void addBaseChain(const char* name, const char* type, uint32_t hook, int32_t priority) {
+        begin(NFT_MSG_NEWCHAIN, NLM_F_CREATE);
+        buffer.putString(NFTA_CHAIN_TABLE, NFT_TABLE_NAME);
+        buffer.putString(NFTA_CHAIN_NAME, name);
+        size_t hookAttr = buffer.beginNested(NFTA_CHAIN_HOOK);
+        buffer.putU32Be(NFTA_HOOK_HOOKNUM, hook);
+        buffer.putU32Be(NFTA_HOOK_PRIORITY, static_cast<uint32_t>(priority));
+        buffer.endNested(hookAttr);
+        buffer.putU32Be(NFTA_CHAIN_POLICY, NFT_VERDICT_ACCEPT);
+        buffer.putString(NFTA_CHAIN_TYPE, type);
+        buffer.endMessage();
+    }
+
+    // removes all the rules of a chain
+    void flushChain(const char* name) {
+        begin(NFT_MSG_DELRULE, 0);
+        buffer.putString(NFTA_RULE_TABLE, NFT_TABLE_NAME);
+        buffer.putString(NFTA_RULE_CHAIN, name);
+        buffer.endMessage();
+    }
+
+    // a rule is started, filled with expressions and ended
+    void beginRule(const char* chain) {
+        begin(NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND);
+        buffer.putString(NFTA_RULE_TABLE, NFT_TABLE_NAME);
+        buffer.putString(NFTA_RULE_CHAIN, chain);
+        expressions = buffer.beginNested(NFTA_RULE_EXPRESSIONS);
+    }
+
+    void endRule() {
+        buffer.endNested(expressions);
+        buffer.endMessage();
+    }
+
+    // meta iifname/oifname == name
+    void matchInterface(uint32_t metaKey, const char* ifname) {
+        size_t data = beginExpression("meta");
+        buffer.putU32Be(NFTA_META_KEY, metaKey);
+        buffer.putU32Be(NFTA_META_DREG, NFT_REG_1);
+        endExpression(data);
+        char name[IFNAMSIZ];
+        memset(name, 0, sizeof(name));
+        strncpy(name, ifname, IFNAMSIZ - 1);
+        compare(NFT_CMP_EQ, name, sizeof(name));
+    }
+
+    // ct state & mask != 0
+    void matchConntrackState(uint32_t mask) {
+        size_t data = beginExpression("ct");
+        buffer.putU32Be(NFTA_CT_KEY, NFT_CT_STATE);
+        buffer.putU32Be(NFTA_CT_DREG, NFT_REG_1);
+        endExpression(data);
+        uint32_t zero = 0;
+        data = beginExpression("bitwise");
+        buffer.putU32Be(NFTA_BITWISE_SREG, NFT_REG_1);
+        buffer.putU32Be(NFTA_BITWISE_DREG, NFT_REG_1);
+        buffer.putU32Be(NFTA_BITWISE_LEN, sizeof(mask));
+        size_t value = buffer.beginNested(NFTA_BITWISE_MASK);
+        buffer.putAttr(NFTA_DATA_VALUE, &mask, sizeof(mask));
+        buffer.endNested(value);
+        value = buffer.beginNested(NFTA_BITWISE_XOR);
+        buffer.putAttr(NFTA_DATA_VALUE, &zero, sizeof(zero));
+        buffer.endNested(value);
+        endExpression(data);
+        compare(NFT_CMP_NEQ, &zero, sizeof(zero));
+    }
+
+    // meta l4proto == protocol
+    void matchProtocol(uint8_t protocol) {
+        size_t data = beginExpression("meta");
+        buffer.putU32Be(NFTA_META_KEY, NFT_META_L4PROTO);
+        buffer.putU32Be(NFTA_META_DREG, NFT_REG_1);
+        endExpression(data);
+        compare(NFT_CMP_EQ, &protocol, sizeof(protocol));
+    }
+
+    // tcp flags & syn != 0 (after matchProtocol(IPPROTO_TCP))
+    void matchTcpSyn() {
+        size_t data = beginExpression("payload");
+        buffer.putU32Be(NFTA_PAYLOAD_DREG, NFT_REG_1);
+        buffer.putU32Be(NFTA_PAYLOAD_BASE, NFT_PAYLOAD_TRANSPORT_HEADER);
+        buffer.putU32Be(NFTA_PAYLOAD_OFFSET, 13);
+        buffer.putU32Be(NFTA_PAYLOAD_LEN, 1);
+        endExpression(data);
+        uint8_t syn = 0x02;
+        uint8_t zero = 0;
+        data = beginExpression("bitwise");
+        buffer.putU32Be(NFTA_BITWISE_SREG, NFT_REG_1);
+        buffer.putU32Be(NFTA_BITWISE_DREG, NFT_REG_1);
+        buffer.putU32Be(NFTA_BITWISE_LEN, sizeof(syn));
+        size_t value = buffer.beginNested(NFTA_BITWISE_MASK);
+        buffer.putAttr(NFTA_DATA_VALUE, &syn, sizeof(syn));
+        buffer.endNested(value);
+        value = buffer.beginNested(NFTA_BITWISE_XOR);
+        buffer.putAttr(NFTA_DATA_VALUE, &zero, sizeof(zero));
+        buffer.endNested(value);
+        endExpression(data);
+        compare(NFT_CMP_NEQ, &zero, sizeof(zero));
+    }
+
+    // meta mark != mark
+    void matchMarkNot(uint32_t mark) {
+        size_t data = beginExpression("meta");
+        buffer.putU32Be(NFTA_META_KEY, NFT_META_MARK);
+        buffer.putU32Be(NFTA_META_DREG, NFT_REG_1);
+        endExpression(data);
+        compare(NFT_CMP_NEQ, &mark, sizeof(mark));
+    }
+
+    // redirect to :port (the port goes through a register, as nft does it)
+    void redirect(uint16_t port) {
+        size_t data = beginExpression("immediate");
+        buffer.putU32Be(NFTA_IMMEDIATE_DREG, NFT_REG_1);
+        size_t immediate = buffer.beginNested(NFTA_IMMEDIATE_DATA);
+        uint16_t networkPort = htons(port);
+        buffer.putAttr(NFTA_DATA_VALUE, &networkPort, sizeof(networkPort));
+        buffer.endNested(immediate);
+        endExpression(data);
+        data = beginExpression("redir");
+        buffer.putU32Be(NFTA_REDIR_REG_PROTO_MIN, NFT_REG_1);
+        endExpression(data);
+    }
+
+    // tcp option maxseg size set mss (the kernel only ever lowers it)
+    void setMss(uint16_t mss) {
+        size_t data = beginExpression("immediate");
+        buffer.putU32Be(NFTA_IMMEDIATE_DREG, NFT_REG_1);
+        size_t immediate = buffer.beginNested(NFTA_IMMEDIATE_DATA);
+        uint16_t networkMss = htons(mss);
+        buffer.putAttr(NFTA_DATA_VALUE, &networkMss, sizeof(networkMss));
+        buffer.endNested(immediate);
+        endExpression(data);
+        data = beginExpression("exthdr");
+        buffer.putU32Be(NFTA_EXTHDR_SREG, NFT_REG_1);
+        uint8_t maxseg = 2;
+        buffer.putAttr(NFTA_EXTHDR_TYPE, &maxseg, sizeof(maxseg));
+        buffer.putU32Be(NFTA_EXTHDR_OFFSET, 2);
+        buffer.putU32Be(NFTA_EXTHDR_LEN, sizeof(mss));
+        buffer.putU32Be(NFTA_EXTHDR_OP, NFT_EXTHDR_OP_TCPOPT);
+        endExpression(data);
+    }
+
+    void accept() {
+        size_t data = beginExpression("immediate");
+        buffer.putU32Be(NFTA_IMMEDIATE_DREG, NFT_REG_VERDICT);
+        size_t immediate = buffer.beginNested(NFTA_IMMEDIATE_DATA);
+        size_t verdict = buffer.beginNested(NFTA_DATA_VERDICT);
+        buffer.putU32Be(NFTA_VERDICT_CODE, NFT_VERDICT_ACCEPT);
+        buffer.endNested(verdict);
+        buffer.endNested(immediate);
+        endExpression(data);
+    }
+
+    void masquerade() {
+        size_t element = buffer.beginNested(NFTA_LIST_ELEM);
+        buffer.putString(NFTA_EXPR_NAME, "masq");
+        buffer.endNested(element);
+    }
+
+    // commits the whole batch atomically, returns 0 or -errno
+    int commit() {
+        batchMessage(NFNL_MSG_BATCH_END);
+        return netlink.transact(buffer, acks);
+    }
+
+private:
+    void batchMessage(uint16_t type) {
+        buffer.beginMessage(type, NLM_F_REQUEST, netlink.nextSeq());
+        struct nfgenmsg header;
+        memset(&header, 0, sizeof(header));
+        header.nfgen_family = AF_UNSPEC;
+        header.version = NFNETLINK_V0;
+        header.res_id = htons(NFNL_SUBSYS_NFTABLES);
+        buffer.putHeader(header);
+        buffer.endMessage();
+    }
+
+    void begin(uint16_t type, uint16_t flags) {
+        buffer.beginMessage((NFNL_SUBSYS_NFTABLES << 8) | type, NLM_F_REQUEST | NLM_F_ACK | flags, netlink.nextSeq());
+        struct nfgenmsg header;
+        memset(&header, 0, sizeof(header));
+        header.nfgen_family = NFT_PROTO_IPV4;
+        header.version = NFNETLINK_V0;
+        header.res_id = 0;
+        buffer.putHeader(header);
+        ++acks;
+    }
+
+    size_t beginExpression(const char* name) {
+        currentElement = buffer.beginNested(NFTA_LIST_ELEM);
+        buffer.putString(NFTA_EXPR_NAME, name);
+        return buffer.beginNested(NFTA_EXPR_DATA);
+    }
+
+    void endExpression(size_t data) {
+        buffer.endNested(data);
+        buffer.endNested(currentElement);
+    }
+
+    void compare(uint32_t op, const void* value, size_t length) {
+        size_t data = beginExpression("cmp");
+        buffer.putU32Be(NFTA_CMP_SREG, NFT_REG_1);
+        buffer.putU32Be(NFTA_CMP_OP, op);
+        size_t valueAttr = buffer.beginNested(NFTA_CMP_DATA);
+        buffer.putAttr(NFTA_DATA_VALUE, value, length);
+        buffer.endNested(valueAttr);
+        endExpression(data);
+    }
+
+    Netlink& netlink;
+    NetlinkBuffer buffer;
+    int acks;
+    size_t expressions;
+    size_t currentElement;
+};
+
+// masquerade of the traffic leaving through the uplink and forwarding between the uplink and the tun interface,
+// replaces whatever our table contained before (the same as the three iptables rules, without the duplicates)
+inline bool setupNat(const char* tunName, const char* uplinkName) {
+    Netlink netlink(NETLINK_NETFILTER);
+    NftBatch batch(netlink);
+    // adding before deleting makes the delete succeed even when the table does not exist yet
+    batch.addTable();
+    batch.deleteTable();
+    batch.addTable();
+    batch.addBaseChain("postrouting", "nat", NFT_HOOK_POST_ROUTING, 100);
+    batch.addBaseChain("forward", "filter", NFT_HOOK_FORWARD, 0);
+    // oifname "eth0" masquerade
+    batch.beginRule("postrouting");
+    batch.matchInterface(NFT_META_OIFNAME, uplinkName);
+    batch.masquerade();
+    batch.endRule();
+    // iifname "eth0" oifname "tun0" ct state related,established accept
+    batch.beginRule("forward");
+    batch.matchInterface(NFT_META_IIFNAME, uplinkName);
+    batch.matchInterface(NFT_META_OIFNAME, tunName);
+    batch.matchConntrackState(NFT_CT_STATE_ESTABLISHED | NFT_CT_STATE_RELATED);
+    batch.accept();
+    batch.endRule();
+    // iifname "tun0" oifname "eth0" accept
+    batch.beginRule("forward");
+    batch.matchInterface(NFT_META_IIFNAME, tunName);
+    batch.matchInterface(NFT_META_OIFNAME, uplinkName);
+    batch.accept();
+    batch.endRule();
+    int error = batch.commit();
+    if(error != 0) {
+        LOG_ERROR(LOG_MAIN, "Failed to set up the nftables NAT table, errno = {}", -error);
+        return false;
+    }
+    return true;
+}
+
+// sends the tcp connections crossing the tun interface to the local proxy (see tcpProxy.h):
+// - base station: iifname "tun0" meta l4proto tcp redirect to :port (connections of the mobile side)
+// - mobile station: oifname "tun0" meta l4proto tcp meta mark != mark redirect to :port (our own connections, but not
+//   the ones the proxy opens, it marks them)
+// the mobile station has no other rules, so there the table is created here, the base station adds to its nat table
+inline bool setupProxyRedirect(const char* tunName, uint16_t port, uint32_t mark, bool baseStation) {
+    Netlink netlink(NETLINK_NETFILTER);
+    NftBatch batch(netlink);
+    if(!baseStation) {
+        batch.addTable();
+        batch.deleteTable();
+    }
+    batch.addTable();
+    if(baseStation) {
+        batch.addBaseChain("prerouting", "nat", NFT_HOOK_PRE_ROUTING, -100);
+        batch.beginRule("prerouting");
+        batch.matchInterface(NFT_META_IIFNAME, tunName);
+    } else {
+        batch.addBaseChain("output", "nat", NFT_HOOK_LOCAL_OUT, -100);
+        batch.beginRule("output");
+        batch.matchInterface(NFT_META_OIFNAME, tunName);
+        batch.matchMarkNot(mark);
+    }
+    batch.matchProtocol(IPPROTO_TCP);
+    batch.redirect(port);
+    batch.endRule();
+    int error = batch.commit();
+    if(error != 0) {
+        LOG_ERROR(LOG_MAIN, "Failed to set up the nftables proxy redirect, errno = {}", -error);
+        return false;
+    }
+    return true;
+}
+
+// clamps the mss of the tcp connections through the tun interface (base station), so the servers send segments that
+// fit the mtu of tun0, called again whenever the mtu changes (the rules are replaced in one batch):
+//   iifname "tun0" tcp flags syn tcp option maxseg size set mss
+//   oifname "tun0" tcp flags syn tcp option maxseg size set mss
+inline bool setMssClamp(const char* tunName, uint16_t mss) {
+    Netlink netlink(NETLINK_NETFILTER);
+    NftBatch batch(netlink);
+    batch.addTable();
+    // before the forward chain of setupNat (mangle priority)
+    batch.addBaseChain("mssclamp", "filter", NFT_HOOK_FORWARD, -150);
+    batch.flushChain("mssclamp");
+    for(int i = 0; i < 2; ++i) {
+        batch.beginRule("mssclamp");
+        batch.matchInterface(i == 0 ? NFT_META_IIFNAME : NFT_META_OIFNAME, tunName);
+        batch.matchProtocol(IPPROTO_TCP);
+        batch.matchTcpSyn();
+        batch.setMss(mss);
+        batch.endRule();
+    }
+    int error = batch.commit();
+    if(error != 0) {
+        LOG_ERROR(LOG_MAIN, "Failed to set up the nftables mss clamp, errno = {}", -error);
+        return false;
+    }
+    return true;
+}
+
+// removes our nftables table
+inline bool teardownNat() {
+    Netlink netlink(NETLINK_NETFILTER);
+    NftBatch batch(netlink);
+    batch.addTable();
+    batch.deleteTable();
+    int error = batch.commit();
+    if(error != 0) {
+        LOG_ERROR(LOG_MAIN, "Failed to remove the nftables NAT table, errno = {}", -error);
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,148 @@
+-- Wireshark dissector for the radio frames captured with --capture (see frameCapture.h)
+-- Install: copy into the wireshark plugin folder (e.g. ~/.local/lib/wireshark/plugins/) or run
+--   wireshark -X lua_script:nrf24arq.lua capture.pcap
+-- The capture uses link type USER0 (147), every record starts with a 4 byte pseudo header:
+--   version, radio (0 = send radio, 1 = receive radio), direction (0 = tx, 1 = rx), frame length
+-- followed by the frame itself, whose first byte is our ARQ header:
+--   bit 7 = acknowledgement, bit 6 = alternating bit of the ip packet, bits 0-5 = sequence number
+-- Wire format v2 has no start message, fragment 1 begins with the ipv4 header that gives the size of the packet.
+-- The crc32c of the packet follows its last byte. Packets sealed with --psk keep the first 4 bytes of the header
+-- readable (the size is then of the sealed packet).
+
+local arq = Proto("nrf24arq", "nRF24 ARQ radio frame")
+
+local radios = { [0] = "send", [1] = "receive" }
+local directions = { [0] = "tx", [1] = "rx" }
+
+local f_version   = ProtoField.uint8("nrf24arq.version", "Pseudo header version")
+local f_radio     = ProtoField.uint8("nrf24arq.radio", "Radio", base.DEC, radios)
+local f_direction = ProtoField.uint8("nrf24arq.direction", "Direction", base.DEC, directions)
+local f_length    = ProtoField.uint8("nrf24arq.length", "Frame length")
+local f_header    = ProtoField.uint8("nrf24arq.header", "Header", base.HEX)
+local f_ack       = ProtoField.bool("nrf24arq.ack", "Acknowledgement", 8, nil, 0x80)
+local f_alt       = ProtoField.bool("nrf24arq.alt", "Alternating bit", 8, nil, 0x40)
+local f_seq       = ProtoField.uint8("nrf24arq.seq", "Sequence number", base.DEC, nil, 0x3f)
+local f_fragments = ProtoField.uint8("nrf24arq.fragments", "Fragments of the ip packet")
+local f_size      = ProtoField.uint16("nrf24arq.size", "Size of the ip packet")
+local f_payload   = ProtoField.bytes("nrf24arq.payload", "Fragment payload")
+local f_control   = ProtoField.uint8("nrf24arq.control", "Control type")
+local f_more_ack  = ProtoField.uint8("nrf24arq.more_ack", "Coalesced acknowledgement", base.HEX)
+local f_trailer   = ProtoField.uint8("nrf24arq.trailer_ack", "Piggybacked acknowledgement (if --piggyback)", base.HEX)
+local f_bitmap    = ProtoField.uint16("nrf24arq.trailer_bitmap", "Piggybacked acknowledgement bitmap", base.HEX)
+local f_policy    = ProtoField.uint8("nrf24arq.policy", "Acknowledgement policy", base.DEC, { [0] = "ack", [1] = "nak", [2] = "block" })
+local f_block     = ProtoField.uint64("nrf24arq.block_ack", "Sequence numbers received (bitmap)", base.HEX)
+local f_dgram_id  = ProtoField.uint8("nrf24arq.datagram_id", "Fast path packet id")
+local f_dgram_idx = ProtoField.uint8("nrf24arq.datagram_index", "Fast path fragment index")
+
+arq.fields = { f_version, f_radio, f_direction, f_length, f_header, f_ack, f_alt, f_seq, f_fragments, f_size, f_payload, f_control, f_more_ack, f_trailer, f_bitmap, f_policy, f_block, f_dgram_id, f_dgram_idx }
+
+function arq.dissector(buffer, pinfo, tree)
+    if buffer:len() < 5 then
+        return 0
+    end
+    pinfo.cols.protocol = "nRF24-ARQ"
+
+    local subtree = tree:add(arq, buffer(), "nRF24 ARQ radio frame")
+    subtree:add(f_version, buffer(0, 1))
+    subtree:add(f_radio, buffer(1, 1))
+    subtree:add(f_direction, buffer(2, 1))
+    subtree:add(f_length, buffer(3, 1))
+
+    local frame = buffer(4)
+    local header = frame(0, 1):uint()
+    local isAck = bit.band(header, 0x80) ~= 0
+    local alt = bit.rshift(bit.band(header, 0x40), 6)
+    local seq = bit.band(header, 0x3f)
+
+    local headerTree = subtree:add(f_header, frame(0, 1))
+    headerTree:add(f_ack, frame(0, 1))
+    headerTree:add(f_alt, frame(0, 1))
+    headerTree:add(f_seq, frame(0, 1))
+
+    -- with --piggyback data frames end with an acknowledgement trailer (see piggyback.h), the capture does not say
+    -- which mode was used, so it is shown when it looks like one (the frames of larger links are captured cut to
+    -- 32 bytes, the pseudo header tells their length, their trailer is not in the capture)
+    local function addTrailer()
+        if frame:len() == 32 and buffer(3, 1):uint() == 32 and bit.band(frame(29, 1):uint(), 0x80) ~= 0 then
+            local base = frame(29, 1):uint()
+            subtree:add(f_trailer, frame(29, 1))
+            subtree:add(f_bitmap, frame(30, 2))
+            return " piggyback ack seq=" .. bit.band(base, 0x3f) .. " alt=" .. bit.rshift(bit.band(base, 0x40), 6) .. " +" .. string.format("%04x", frame(30, 2):uint())
+        end
+        return ""
+    end
+
+    local direction = directions[buffer(2, 1):uint()] or "?"
+    local info
+    if isAck then
+        if seq == 63 then
+            info = "final (ip packet received or aborted)"
+        else
+            info = "ack/nak seq=" .. seq
+        end
+        -- the tx arbiter puts several acknowledgements into one frame, one per byte with the most significant bit set
+        local i = 1
+        while i < frame:len() and bit.band(frame(i, 1):uint(), 0x80) ~= 0 do
+            local more = frame(i, 1):uint()
+            subtree:add(f_more_ack, frame(i, 1))
+            info = info .. ", " .. (bit.band(more, 0x3f) == 63 and "final" or ("seq=" .. bit.band(more, 0x3f))) .. " alt=" .. bit.rshift(bit.band(more, 0x40), 6)
+            i = i + 1
+        end
+    elseif seq == 63 then
+        -- control frame, the second byte tells which one (see controlFrames.h)
+        local controls = { [1] = "abort", [2] = "hello", [3] = "hello ack", [4] = "keepalive", [5] = "poll",
+                           [6] = "policy", [7] = "policy ack", [8] = "block ack", [9] = "corrupt", [10] = "corrupt ack",
+                           [11] = "credit", [12] = "datagram" }
+        local policies = { [0] = "ack", [1] = "nak", [2] = "block" }
+        local control = 0
+        if frame:len() > 1 then
+            control = frame(1, 1):uint()
+            subtree:add(f_control, frame(1, 1))
+        end
+        info = "control " .. (controls[control] or tostring(control))
+        if control == 5 and frame:len() > 2 then
+            subtree:add(f_fragments, frame(2, 1))
+            info = info .. " fragments=" .. frame(2, 1):uint()
+        elseif (control == 6 or control == 7) and frame:len() > 2 then
+            subtree:add(f_policy, frame(2, 1))
+            info = info .. " " .. (policies[frame(2, 1):uint()] or tostring(frame(2, 1):uint()))
+        elseif control == 8 and frame:len() >= 10 then
+            subtree:add_le(f_block, frame(2, 8))
+            info = info .. " alt=" .. bit.rshift(bit.band(header, 0x40), 6)
+        elseif control == 11 and frame:len() >= 6 then
+            info = info .. " buffers=" .. frame(2, 1):uint() .. " drain=" .. frame(3, 2):le_uint() .. "us fifo-full=" .. frame(5, 1):uint()
+        elseif control == 12 and frame:len() >= 4 then
+            -- a fragment of an ip packet on the unacknowledged fast path (see fastPath.h)
+            subtree:add(f_dgram_id, frame(2, 1))
+            subtree:add(f_dgram_idx, frame(3, 1))
+            info = info .. " id=" .. frame(2, 1):uint() .. " index=" .. frame(3, 1):uint()
+            if frame:len() > 4 then
+                subtree:add(f_payload, frame(4))
+            end
+        end
+    elseif seq == 0 then
+        -- the start message of wire format v1
+        info = "v1 start (old peer)"
+        if frame:len() >= 4 then
+            subtree:add(f_fragments, frame(1, 1))
+            subtree:add(f_size, frame(2, 2))
+            info = info .. " fragments=" .. frame(1, 1):uint() .. " size=" .. frame(2, 2):uint()
+        end
+        info = info .. addTrailer()
+    else
+        info = "data seq=" .. seq
+        if seq == 1 and frame:len() >= 5 then
+            subtree:add(f_size, frame(3, 2))
+            info = info .. " ip size=" .. frame(3, 2):uint()
+        end
+        if frame:len() > 1 then
+            subtree:add(f_payload, frame(1))
+        end
+        info = info .. addTrailer()
+    end
+    pinfo.cols.info = direction .. " alt=" .. alt .. " " .. info
+    return buffer:len()
+end
+
+local encapTable = DissectorTable.get("wtap_encap")
+encapTable:add(wtap.USER0, arq)
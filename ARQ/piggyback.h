@@ -0,0 +1,67 @@
+#ifndef PIGGYBACK_H
+#define PIGGYBACK_H
+
+// Piggybacked acknowledgements (--piggyback, both stations must use it).
+// When both directions carry data, the acknowledgements ride in a trailer of the data frames going the other way
+// instead of taking a radio frame of their own. A data fragment then carries 28 instead of 31 bytes of the ip packet
+// and the last 3 bytes of the frame are the trailer (at the end of larger frames too, see frameGeometry.h):
+//   [base acknowledgement (most significant bit set, 0 = no trailer), bitmap of the next 16 sequence numbers (2 bytes)]
+// bit i of the bitmap (most significant first) acknowledges sequence number base + 1 + i with the alternating bit of the base.
+// Acknowledgements that don't fit wait for the next data frame, a standalone acknowledgement frame goes out only when
+// they waited for --piggyback-us (there was no data to ride on).
+
+#include <stdint.h>
+
+#define PIGGYBACK_TRAILER_SIZE 3
+#define PIGGYBACK_BITMAP_BITS 16
+// longest wait for a data frame, well below the 1 ms after which the sender of the peer resends
+#define PIGGYBACK_DEFAULT_US 300
+
+// puts as many of the acknowledgements as possible into the trailer (the first one is the base), removes them from
+// the list, returns how many were packed
+inline uint8_t packAckTrailer(uint8_t* acks, uint8_t& count, uint8_t* trailer) {
+    trailer[0] = 0;
+    trailer[1] = 0;
+    trailer[2] = 0;
+    if(count == 0) {
+        return 0;
+    }
+    uint8_t base = acks[0];
+    trailer[0] = base;
+    uint16_t bitmap = 0;
+    uint8_t packed = 1;
+    uint8_t kept = 0;
+    for(uint8_t i = 1; i < count; ++i) {
+        int offset = static_cast<int>(acks[i] & 0x3F) - static_cast<int>(base & 0x3F) - 1;
+        // same alternating bit (and ack / final kind) as the base, within the bitmap
+        if((acks[i] & 0xC0) == (base & 0xC0) && offset >= 0 && offset < PIGGYBACK_BITMAP_BITS) {
+            bitmap |= static_cast<uint16_t>(0x8000 >> offset);
+            ++packed;
+        } else {
+            acks[kept++] = acks[i];
+        }
+    }
+    count = kept;
+    trailer[1] = bitmap >> 8;
+    trailer[2] = bitmap & 0xFF;
+    return packed;
+}
+
+// the acknowledgements of a trailer, one per byte as in an acknowledgement frame, returns how many
+inline uint8_t unpackAckTrailer(const uint8_t* trailer, uint8_t* acks) {
+    if((trailer[0] & 0x80) == 0) {
+        return 0;
+    }
+    uint8_t count = 0;
+    acks[count++] = trailer[0];
+    uint16_t bitmap = static_cast<uint16_t>((trailer[1] << 8) | trailer[2]);
+    for(int i = 0; i < PIGGYBACK_BITMAP_BITS; ++i) {
+        int seq = (trailer[0] & 0x3F) + 1 + i;
+        if((bitmap & (0x8000 >> i)) != 0 && seq <= 63) {
+            acks[count++] = static_cast<uint8_t>((trailer[0] & 0xC0) | seq);
+        }
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+// The ARQ runs as a pipeline of four threads, so the radio threads never wait for tun0 or for packet parsing:
+//   tun reader  -> read from tun0, check it is an ip packet, classify          -> outgoing pipe
+//   sender      -> fragment, send on the send radio, resend until acknowledged (radio TX)
+//   receiver    -> drain the receive radio, acknowledge, reassemble            -> incoming pipe (radio RX)
+//   tun writer  -> check the reassembled ip packet, write to tun0
+// A pipe is a fixed pool of packet buffers moving around two lock-free single producer / single consumer rings:
+// the filled buffers go forward, the empty ones come back, nothing is copied or allocated per packet.
+// The sender frames a packet once into the frame arena of its buffer and hands the tx arbiter pointers into it (the
+// resends too), the buffer counts the frames queued and goes back to the tun reader only when none is left.
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include "trafficClass.h"
+#include "hotRestart.h"
+#include "asyncLog.h"
+#include "ackFilter.h"
+
+#define PACKET_BUFFER_SIZE 2048
+// buffers per direction (power of two), the rings hold all of them, so pushing a buffer never fails
+#define PIPELINE_BUFFERS 16
+// how long an idle stage sleeps before looking if it should park for a hot restart
+#define PIPELINE_POLL_MS 20
+// the frames of an ip packet (sequence numbers 1 to 62), as they go on air
+#define PACKET_FRAMES 62
+// bytes of the frame arena, the frames of a packet follow each other with the frame size of the link (see frameGeometry.h)
+#define PACKET_ARENA_SIZE 2048
+
+enum PipelineStage {
+    STAGE_TUN_READER,
+    STAGE_SENDER,
+    STAGE_RECEIVER,
+    STAGE_TUN_WRITER,
+    STAGE_COUNT
+};
+
+static_assert(STAGE_COUNT == HANDOVER_STAGES, "every pipeline stage parks during a hot restart");
+
+struct PacketBuffer {
+    uint16_t length;
+    TrafficClass trafficClass;
+    std::chrono::steady_clock::time_point readAt;   // the lifetime of the class counts from here (time in the pipe included)
+    std::atomic<uint8_t> queuedState;               // QueuedState, a queued tcp ack may be superseded (see ackFilter.h)
+    uint32_t serial;
+    uint8_t data[PACKET_BUFFER_SIZE];
+    // the packet framed by the sender, header included (outgoing pipe only), frame i has sequence number i + 1
+    uint8_t frames[PACKET_ARENA_SIZE];
+    uint8_t frameLengths[PACKET_FRAMES];
+    std::atomic<int> references;                    // frames of the arena queued in the tx arbiter
+};
+
+// the frame with the sequence number in the arena of the packet
+template <typename Geometry>
+inline uint8_t* packetFrame(PacketBuffer* packet, uint8_t seq) {
+    return packet->frames + (seq - 1) * Geometry::frameSize;
+}
+
+// frames the packet for the link once, returns the number of fragments
+template <typename Geometry>
+inline uint8_t framePacket(PacketBuffer* packet, bool altBool) {
+    uint8_t seq = 1;
+    for(int index = 0; index < packet->length && seq <= Geometry::maxFragments; ++seq, index += Geometry::payload) {
+        int cap = std::min<int>(Geometry::payload, packet->length - index);
+        uint8_t* frame = packetFrame<Geometry>(packet, seq);
+        frame[0] = (altBool ? 0x40 : 0) + seq;
+        memcpy(frame + Geometry::headerSize, packet->data + index, cap);
+        packet->frameLengths[seq - 1] = static_cast<uint8_t>(cap + Geometry::headerSize);
+    }
+    return seq - 1;
+}
+
+template <typename T, size_t Size>
+class SpscRing {
+    static_assert((Size & (Size - 1)) == 0, "ring size must be a power of two");
+public:
+    SpscRing() : head(0), tail(0) {}
+
+    bool push(T value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h - tail.load(std::memory_order_acquire) >= Size) {
+            return false;
+        }
+        items[h & (Size - 1)] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = items[t & (Size - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+    }
+
+    // a snapshot, the other side may be pushing or popping
+    size_t size() const {
+        size_t t = tail.load(std::memory_order_acquire);
+        return head.load(std::memory_order_acquire) - t;
+    }
+
+private:
+    T items[Size];
+    // producer and consumer index on their own cache lines
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+// a ring of buffers with an eventfd, so the consumer can sleep while it is empty
+class PacketQueue {
+public:
+    PacketQueue() {
+        eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(eventFd < 0) {
+            perror("Failed to create eventfd");
+        }
+    }
+
+    ~PacketQueue() {
+        if(eventFd >= 0) {
+            close(eventFd);
+        }
+    }
+
+    // never blocks (the eventfd counter does not overflow)
+    void push(PacketBuffer* packet) {
+        if(!ring.push(packet)) {
+            // can't happen, the ring is as large as the pool
+            LOG_ERROR(LOG_MAIN, "Packet queue full");
+            return;
+        }
+        uint64_t one = 1;
+        ssize_t written = write(eventFd, &one, sizeof(one));
+        (void)written;
+    }
+
+    PacketBuffer* tryPop() {
+        PacketBuffer* packet = NULL;
+        ring.pop(packet);
+        return packet;
+    }
+
+    // waits up to timeoutMs for a buffer, NULL if there is none
+    PacketBuffer* pop(int timeoutMs) {
+        PacketBuffer* packet = tryPop();
+        if(packet != NULL) {
+            return packet;
+        }
+        struct pollfd readable;
+        readable.fd = eventFd;
+        readable.events = POLLIN;
+        if(poll(&readable, 1, timeoutMs) > 0) {
+            uint64_t count;
+            ssize_t length = read(eventFd, &count, sizeof(count));
+            (void)length;
+        }
+        return tryPop();
+    }
+
+    bool empty() const {
+        return ring.empty();
+    }
+
+    size_t size() const {
+        return ring.size();
+    }
+
+private:
+    SpscRing<PacketBuffer*, PIPELINE_BUFFERS> ring;
+    int eventFd;
+};
+
+// one direction of the pipeline
+class PacketPipe {
+public:
+    PacketPipe() : storage(PIPELINE_BUFFERS), dropped(0) {
+        for(size_t i = 0; i < storage.size(); ++i) {
+            memset(storage[i].data, 0, PACKET_BUFFER_SIZE);
+            storage[i].references.store(0);
+            freeBuffers.push(&storage[i]);
+        }
+    }
+
+    PacketQueue packets;        // filled, from the producing to the consuming stage
+    PacketQueue freeBuffers;    // empty, back to the producing stage
+    std::vector<PacketBuffer> storage;
+    std::atomic<uint64_t> dropped;      // packets dropped because the consuming stage fell behind
+};
+
+// pins the thread of a stage to a cpu (-1 = anywhere)
+inline void pinThread(std::thread& thread, int cpu) {
+    if(cpu < 0) {
+        return;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int error = pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+    if(error != 0) {
+        LOG_WARN(LOG_MAIN, "Failed to pin a pipeline stage to cpu {}, errno = {}", cpu, error);
+    }
+}
+
+// parses "reader,sender,receiver,writer" cpu numbers (-1 = not pinned), e.g. "0,1,2,3"
+inline bool parseCpuList(const std::string& spec, int cpus[STAGE_COUNT]) {
+    size_t begin = 0;
+    for(int stage = 0; stage < STAGE_COUNT; ++stage) {
+        size_t end = spec.find(',', begin);
+        if((end == std::string::npos) != (stage == STAGE_COUNT - 1)) {
+            return false;
+        }
+        if(end == std::string::npos) {
+            end = spec.size();
+        }
+        std::string item = spec.substr(begin, end - begin);
+        char* rest;
+        long cpu = strtol(item.c_str(), &rest, 10);
+        if(item.empty() || *rest != '\0' || cpu < -1 || cpu >= CPU_SETSIZE) {
+            return false;
+        }
+        cpus[stage] = static_cast<int>(cpu);
+        begin = end + 1;
+    }
+    return true;
+}
+
+// ---- the tun facing stages, the radio facing ones are sendData / receiveData ----
+
+typedef bool (*PacketCheck)(const uint8_t* data, ssize_t size);
+// the check of the tun writer may change the packet (a sealed one is opened in place, see linkCrypto.h)
+typedef bool (*PacketOpen)(PacketBuffer* packet);
+// takes a packet past the pipe (the fast path, see fastPath.h), true if it did, its buffer is free again right away
+typedef bool (*PacketBypass)(PacketBuffer* packet);
+
+inline void tunReader(int tunFd, PacketPipe& pipe, PacketCheck isIpPacket, PacketBypass bypass) {
+    PacketBuffer* packet = NULL;
+    struct pollfd readable;
+    readable.fd = tunFd;
+    readable.events = POLLIN;
+    while(true) {
+        // a new process takes over -> we stop reading, what we did not read stays in the queue of tun0
+        if(hotRestart().shouldPark(STAGE_TUN_READER)) {
+            hotRestart().park(STAGE_TUN_READER);
+        }
+        // the sender is behind, the packets wait in tun0 (its queue is the one that overflows)
+        if(packet == NULL) {
+            packet = pipe.freeBuffers.pop(PIPELINE_POLL_MS);
+            continue;
+        }
+        if(poll(&readable, 1, PIPELINE_POLL_MS) <= 0) {
+            continue;
+        }
+        ssize_t bytes_read = read(tunFd, packet->data, PACKET_BUFFER_SIZE);
+        if(bytes_read < 0) {
+            if(errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            perror("Failed to read from TUN device");
+            return;
+        }
+        // check that the packet is ip packet
+        if(!isIpPacket(packet->data, bytes_read)) {
+            continue;
+        }
+        packet->length = static_cast<uint16_t>(bytes_read);
+        // the traffic class decides for how long and how many times the sender tries to deliver the packet
+        packet->trafficClass = trafficPolicy().classify(packet->data, bytes_read);
+        packet->readAt = std::chrono::steady_clock::now();
+        if(bypass(packet)) {
+            continue;
+        }
+        // a pure tcp ack still waiting in the pipe is dropped when this one acknowledges more
+        ackFilter().queue(packet);
+        pipe.packets.push(packet);
+        packet = NULL;
+    }
+}
+
+inline void tunWriter(int tunFd, PacketPipe& pipe, PacketOpen openPacket) {
+    while(true) {
+        PacketBuffer* packet = pipe.packets.pop(PIPELINE_POLL_MS);
+        if(packet == NULL) {
+            if(hotRestart().shouldPark(STAGE_TUN_WRITER)) {
+                hotRestart().park(STAGE_TUN_WRITER);
+            }
+            continue;
+        }
+        // first we check if the received fragments put together an actual ip packet
+        if(openPacket(packet)) {
+            LOG_DEBUG(LOG_RECEIVE, "Received data form an ip packet, {} bytes", packet->length);
+            // send the data to interface
+            ssize_t bytes_written = write(tunFd, packet->data, packet->length);
+            if(bytes_written < 0) {
+                perror("Failed to write to TUN device");
+            }
+        } else {
+            LOG_WARN(LOG_RECEIVE, "Received data are not of an IP packet, {} bytes", packet->length);
+        }
+        pipe.freeBuffers.push(packet);
+    }
+}
+
+#endif
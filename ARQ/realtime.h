@@ -0,0 +1,206 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+// Real-time mode (--rt): the threads facing the radios run under SCHED_FIFO, so other work on the station can not
+// preempt them, and the memory of the program is locked, so they never wait for a page fault.
+// - the tx arbiter, the receiver and the sender get the priorities of --rt-priorities (the arbiter above the sender:
+//   they share a cpu, the sender sleeps on an eventfd while it waits for the arbiter to send its frames)
+// - the receiver does not spin on the radio anymore, a spinning SCHED_FIFO thread would starve its cpu: it sleeps
+//   RT_RECEIVER_POLL_US between looks, well below the time the 3 frame RX FIFO takes to fill
+// - mlockall before the pipes are allocated, so they, the thread stacks and the arenas are faulted in once, and malloc
+//   keeps what it got instead of giving it back to the kernel
+// The tun reader and writer stay normal threads. How late the timed sleeps wake up is measured, cyclictest style: the
+// 1 ms ack wait of the sender, the polls of the receiver and the acknowledgement deadline of the arbiter (piggyback),
+// the stats are logged at the end (also without --rt, for comparison).
+// Pinning is --cpus (see pipeline.h), on a Raspberry Pi isolcpus= keeps the kernel off those cpus too.
+
+#include <atomic>
+#include <string>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "asyncLog.h"
+
+#define RT_RECEIVER_POLL_US 50
+// power of two buckets of the wakeup latency: < 1 us, < 2 us, < 4 us, ..., the last one takes everything above
+#define RT_LATENCY_BUCKETS 20
+
+enum RealtimeThread {
+    RT_TRANSMITTER,     // the tx arbiter, the only one writing to the send radio
+    RT_RECEIVER,
+    RT_SENDER,
+    RT_THREAD_COUNT
+};
+
+// the log only takes literal formats with integer arguments, so every thread has its own line
+static const char* const realtimeLatencyFormats[RT_THREAD_COUNT] = {
+    "transmitter wakeup latency of {} sleeps: mean {} us, 99 % under {} us, max {} us",
+    "receiver wakeup latency of {} sleeps: mean {} us, 99 % under {} us, max {} us",
+    "sender wakeup latency of {} sleeps: mean {} us, 99 % under {} us, max {} us"
+};
+
+// how late the timed sleeps of a thread woke up (only that thread records, the main thread reads)
+struct WakeupLatency {
+    WakeupLatency() : samples(0), totalNs(0), maxNs(0) {
+        for(int i = 0; i < RT_LATENCY_BUCKETS; ++i) {
+            buckets[i].store(0);
+        }
+    }
+
+    void record(uint64_t lateNs) {
+        uint64_t us = lateNs / 1000;
+        int bucket = 0;
+        while(us != 0 && bucket < RT_LATENCY_BUCKETS - 1) {
+            us >>= 1;
+            ++bucket;
+        }
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        samples.fetch_add(1, std::memory_order_relaxed);
+        totalNs.fetch_add(lateNs, std::memory_order_relaxed);
+        if(lateNs > maxNs.load(std::memory_order_relaxed)) {
+            maxNs.store(lateNs, std::memory_order_relaxed);
+        }
+    }
+
+    // the upper bound of the bucket the given share of the samples is in (e.g. 0.99 -> 99 % woke up less late)
+    uint64_t percentileUs(double share) const {
+        uint64_t count = samples.load(std::memory_order_relaxed);
+        uint64_t seen = 0;
+        for(int i = 0; i < RT_LATENCY_BUCKETS; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if(seen >= count * share) {
+                return 1ULL << i;
+            }
+        }
+        return 1ULL << (RT_LATENCY_BUCKETS - 1);
+    }
+
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> maxNs;
+    std::atomic<uint64_t> buckets[RT_LATENCY_BUCKETS];
+};
+
+class Realtime {
+public:
+    Realtime() : enabled(false), memoryLocked(false) {
+        priorities[RT_TRANSMITTER] = 50;
+        priorities[RT_RECEIVER] = 49;
+        priorities[RT_SENDER] = 48;
+    }
+
+    // "transmitter,receiver,sender" SCHED_FIFO priorities, e.g. 50,49,48
+    bool parsePriorities(const std::string& spec) {
+        size_t begin = 0;
+        int parsed[RT_THREAD_COUNT];
+        for(int thread = 0; thread < RT_THREAD_COUNT; ++thread) {
+            size_t end = spec.find(',', begin);
+            if((end == std::string::npos) != (thread == RT_THREAD_COUNT - 1)) {
+                return false;
+            }
+            if(end == std::string::npos) {
+                end = spec.size();
+            }
+            std::string item = spec.substr(begin, end - begin);
+            char* rest;
+            long priority = strtol(item.c_str(), &rest, 10);
+            if(item.empty() || *rest != '\0' || priority < sched_get_priority_min(SCHED_FIFO) || priority > sched_get_priority_max(SCHED_FIFO)) {
+                return false;
+            }
+            parsed[thread] = static_cast<int>(priority);
+            begin = end + 1;
+        }
+        if(parsed[RT_TRANSMITTER] <= parsed[RT_SENDER]) {
+            return false;
+        }
+        for(int thread = 0; thread < RT_THREAD_COUNT; ++thread) {
+            priorities[thread] = parsed[thread];
+        }
+        return true;
+    }
+
+    // locks all the memory of the program, now and what it maps later (before the pipes and threads are created)
+    void lockMemory() {
+        if(!enabled) {
+            return;
+        }
+        // freed memory stays with malloc, large blocks come from its heap and not from mmap
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+        if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            LOG_WARN(LOG_MAIN, "Failed to lock the memory, errno = {}", errno);
+            return;
+        }
+        memoryLocked = true;
+    }
+
+    // called first thing by a radio facing thread: SCHED_FIFO with its priority (nothing without --rt)
+    void enter(RealtimeThread thread) {
+        if(!enabled) {
+            return;
+        }
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priorities[thread];
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if(error != 0) {
+            LOG_WARN(LOG_MAIN, "Failed to run a radio thread under SCHED_FIFO priority {}, errno = {}", priorities[thread], error);
+        }
+    }
+
+    // sleeps until the given time from now and records how late the thread woke up
+    void sleepUs(RealtimeThread thread, int us) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += static_cast<long>(us) * 1000;
+        while(deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_nsec -= 1000000000L;
+            ++deadline.tv_sec;
+        }
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t lateNs = (static_cast<int64_t>(now.tv_sec) - deadline.tv_sec) * 1000000000LL + (now.tv_nsec - deadline.tv_nsec);
+        latency[thread].record(lateNs > 0 ? static_cast<uint64_t>(lateNs) : 0);
+    }
+
+    void logStats() const {
+        if(enabled) {
+            LOG_INFO(LOG_MAIN, "real-time mode: SCHED_FIFO priorities transmitter {}, receiver {}, sender {}, memory locked {}",
+                     priorities[RT_TRANSMITTER], priorities[RT_RECEIVER], priorities[RT_SENDER], memoryLocked);
+        }
+        for(int thread = 0; thread < RT_THREAD_COUNT; ++thread) {
+            const WakeupLatency& stats = latency[thread];
+            uint64_t samples = stats.samples.load(std::memory_order_relaxed);
+            if(samples == 0) {
+                continue;
+            }
+            LOG_INFO(LOG_MAIN, realtimeLatencyFormats[thread], samples, stats.totalNs.load(std::memory_order_relaxed) / samples / 1000, stats.percentileUs(0.99),
+                     stats.maxNs.load(std::memory_order_relaxed) / 1000);
+        }
+    }
+
+    // set before the threads start
+    bool enabled;
+    int priorities[RT_THREAD_COUNT];
+
+    WakeupLatency latency[RT_THREAD_COUNT];
+
+private:
+    bool memoryLocked;
+};
+
+// the real-time settings of the program
+inline Realtime& realtime() {
+    static Realtime instance;
+    return instance;
+}
+
+#endif
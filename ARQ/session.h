@@ -0,0 +1,198 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+// Session between the two stations, so a restarted station does not desync the alternating bits.
+// Every run of the program picks a random epoch. At startup a station sends HELLO (with its epoch) until the peer
+// answers with HELLO_ACK echoing it, only then it starts sending data. A station that sees a new epoch of its peer
+// (in a HELLO or KEEPALIVE) knows the peer restarted: it resets its alternating bits to the initial true, drops what it
+// was receiving and gives up the ip packet it was sending. Keepalives also tell when the peer has been silent for too long.
+//
+// control frame layout: [header (seq 63), type, epoch of the sender (4 bytes), epoch of the receiver as known by the sender (4 bytes),
+//                        framing features of the sender (both stations must use the same)]
+
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <stdint.h>
+#include "controlFrames.h"
+#include "txArbiter.h"
+#include "asyncLog.h"
+
+#define SESSION_FRAME_SIZE 11
+// framing features, a station using other ones than its peer can not read its frames
+#define SESSION_FEATURE_PIGGYBACK 0x01
+// wire format v2, no start message (see controlFrames.h), always set
+#define SESSION_FEATURE_WIRE_V2 0x02
+// the acknowledgement policy is announced with CONTROL_POLICY (see arqPolicy.h), always set
+#define SESSION_FEATURE_POLICY 0x04
+// the ip packets are sealed with the pre-shared key (--psk, see linkCrypto.h)
+#define SESSION_FEATURE_SEALED 0x08
+// the crc32c of every ip packet follows it (see crc32c.h), always set
+#define SESSION_FEATURE_PACKET_CRC 0x10
+// the ip packets of the fast path are understood (CONTROL_DATAGRAM, see fastPath.h), always set
+#define SESSION_FEATURE_DATAGRAM 0x20
+// how often HELLO is repeated until the peer answers
+#define SESSION_HELLO_INTERVAL_MS 10
+
+class Session {
+public:
+    Session() : features(SESSION_FEATURE_WIRE_V2 | SESSION_FEATURE_POLICY | SESSION_FEATURE_PACKET_CRC | SESSION_FEATURE_DATAGRAM), established(false), resetRequested(false), peerEpoch(0), deadPeerMs(1000), lastHeardMs(0), lastHelloMs(0), lastPeerFeatures(0), lastKeepaliveMs(0),
+                alive(false), peerRestarts(0), peerDeaths(0), droppedPeerDead(0) {
+        std::random_device random;
+        do {
+            localEpoch = random();
+        } while(localEpoch == 0);   // 0 means "not known yet" in the frames
+    }
+
+    static int64_t nowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // ---- receiver thread ----
+
+    // called for every frame that arrives from the peer
+    void heard() {
+        lastHeardMs.store(nowMs(), std::memory_order_relaxed);
+    }
+
+    // handles a HELLO / HELLO_ACK / KEEPALIVE, returns true when the peer restarted (the caller resets its receiving
+    // state and calls requestSenderReset), reply is set to the control frame type that should be answered (0 = none)
+    bool onControlFrame(const uint8_t* frame, uint8_t& reply) {
+        uint8_t type = frame[1];
+        uint32_t theirEpoch = readEpoch(frame + 2);
+        uint32_t ourEpochAsTheyKnow = readEpoch(frame + 6);
+        reply = 0;
+        if(theirEpoch == 0) {
+            return false;
+        }
+        if(frame[10] != features && frame[10] != lastPeerFeatures) {
+            LOG_ERROR(LOG_SESSION, "The peer uses framing features {}, we use {} (start both stations with the same options)", frame[10], features);
+        }
+        lastPeerFeatures = frame[10];
+        // the first contact counts as a restart as well, the resets don't hurt the initial state
+        bool restarted = theirEpoch != peerEpoch.load();
+        if(restarted) {
+            LOG_INFO(LOG_SESSION, "Peer epoch changed from {} to {}, resynchronizing", peerEpoch.load(), theirEpoch);
+            if(peerEpoch.load() != 0) {
+                peerRestarts.fetch_add(1, std::memory_order_relaxed);
+            }
+            peerEpoch.store(theirEpoch);
+        }
+        if(type == CONTROL_HELLO) {
+            reply = CONTROL_HELLO_ACK;
+        } else if(type == CONTROL_HELLO_ACK) {
+            if(ourEpochAsTheyKnow == localEpoch && !established.load()) {
+                LOG_INFO(LOG_SESSION, "Session established, local epoch {}, peer epoch {}", localEpoch, theirEpoch);
+                established.store(true);
+            }
+        } else if(type == CONTROL_KEEPALIVE) {
+            // the peer does not know our current epoch (it missed our HELLO) -> we say hello again
+            if(ourEpochAsTheyKnow != localEpoch) {
+                LOG_INFO(LOG_SESSION, "Peer knows us with epoch {}, ours is {}, sending hello again", ourEpochAsTheyKnow, localEpoch);
+                established.store(false);
+            }
+        }
+        return restarted;
+    }
+
+    // asks the sender thread to reset its sending state, done right away if the sender is not in the middle of a packet
+    template <typename ResetSender>
+    void requestSenderReset(ResetSender resetSender) {
+        resetRequested.store(true);
+        if(senderMutex.try_lock()) {
+            resetSender();
+            resetRequested.store(false);
+            senderMutex.unlock();
+        }
+    }
+
+    // periodic duties of the receiver thread: hello until established, keepalives, watching the peer
+    void tick() {
+        int64_t now = nowMs();
+        if(!established.load() && now - lastHelloMs >= SESSION_HELLO_INTERVAL_MS) {
+            lastHelloMs = now;
+            sendControl(CONTROL_HELLO);
+        } else if(established.load() && now - lastKeepaliveMs >= deadPeerMs / 4) {
+            lastKeepaliveMs = now;
+            sendControl(CONTROL_KEEPALIVE);
+        }
+        bool nowAlive = now - lastHeardMs.load(std::memory_order_relaxed) < deadPeerMs;
+        if(nowAlive != alive.load(std::memory_order_relaxed)) {
+            alive.store(nowAlive);
+            if(nowAlive) {
+                LOG_INFO(LOG_SESSION, "Peer is alive");
+            } else {
+                peerDeaths.fetch_add(1, std::memory_order_relaxed);
+                LOG_WARN(LOG_SESSION, "Peer silent for {} ms, considered dead", deadPeerMs);
+            }
+        }
+    }
+
+    void sendControl(uint8_t type) {
+        uint8_t frame[SESSION_FRAME_SIZE];
+        frame[0] = CONTROL_SEQ;
+        frame[1] = type;
+        writeEpoch(frame + 2, localEpoch);
+        writeEpoch(frame + 6, peerEpoch.load());
+        frame[10] = features;
+        txArbiter().send(TX_PRIORITY_CONTROL, frame, SESSION_FRAME_SIZE);
+    }
+
+    // ---- sender thread ----
+
+    // applies a reset the receiver thread asked for, the caller must hold senderMutex
+    template <typename ResetSender>
+    bool applyPendingReset(ResetSender resetSender) {
+        if(!resetRequested.load()) {
+            return false;
+        }
+        resetSender();
+        resetRequested.store(false);
+        return true;
+    }
+
+    bool peerAlive() const {
+        return alive.load(std::memory_order_relaxed);
+    }
+
+    uint32_t localEpoch;
+    uint8_t features;       // SESSION_FEATURE_*, set before the threads start
+    std::atomic<bool> established;
+    std::atomic<bool> resetRequested;
+    std::atomic<uint32_t> peerEpoch;
+    // held by the sender thread while it works on an ip packet (the sending state may change only outside of it)
+    std::mutex senderMutex;
+    int deadPeerMs;
+
+    std::atomic<int64_t> lastHeardMs;
+    int64_t lastHelloMs;
+    uint8_t lastPeerFeatures;
+    int64_t lastKeepaliveMs;
+    std::atomic<bool> alive;
+
+    // statistics
+    std::atomic<uint64_t> peerRestarts;
+    std::atomic<uint64_t> peerDeaths;
+    std::atomic<uint64_t> droppedPeerDead;
+
+private:
+    static uint32_t readEpoch(const uint8_t* bytes) {
+        return (static_cast<uint32_t>(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+    }
+
+    static void writeEpoch(uint8_t* bytes, uint32_t epoch) {
+        bytes[0] = epoch >> 24;
+        bytes[1] = (epoch >> 16) & 0xFF;
+        bytes[2] = (epoch >> 8) & 0xFF;
+        bytes[3] = epoch & 0xFF;
+    }
+};
+
+// the one session of the program
+inline Session& session() {
+    static Session instance;
+    return instance;
+}
+
+#endif
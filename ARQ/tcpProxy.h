@@ -0,0 +1,288 @@
+#ifndef TCP_PROXY_H
+#define TCP_PROXY_H
+
+// Split-TCP proxy (--pep). End to end tcp over the link sees the round trip time of stop and wait with its resends
+// and takes the losses the ARQ has not repaired yet for congestion. With --pep the station terminates the tcp
+// connections crossing tun0 and relays them over a tcp connection of its own:
+// - base station: the connections coming from the mobile side (nftables redirects them to us, see netConfig.h),
+//   so the servers on the internet see the short round trip time of the base station instead of the link's
+// - mobile station: its own outgoing connections, so the mobile applications see a local peer
+// With both stations using it, the link is crossed by proxy to proxy connections only. Those are the link side
+// sockets, they get large buffers and the congestion control given with --pep-cc (bbr by default, it does not take
+// a single loss for congestion), the other side keeps the defaults of the system.
+// The connections live in this process, a hot restart breaks them (the new process accepts the new ones).
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "asyncLog.h"
+
+// from linux/netfilter_ipv4.h, which can not be included next to netinet/in.h
+#ifndef SO_ORIGINAL_DST
+#define SO_ORIGINAL_DST 80
+#endif
+
+#define PROXY_DEFAULT_PORT 7070
+// marks the connections the proxy opens, so the redirect of the mobile station lets them through
+#define PROXY_MARK 0xE17030
+#define PROXY_DEFAULT_CC "bbr"
+// relay buffer per direction of a connection
+#define PROXY_BUFFER_SIZE 65536
+// socket buffers of the link side, a few seconds of the link's goodput
+#define PROXY_LINK_SOCKET_BUFFER (1024 * 1024)
+#define PROXY_MAX_EVENTS 64
+
+class TcpProxy {
+public:
+    TcpProxy() : port(PROXY_DEFAULT_PORT), congestionControl(PROXY_DEFAULT_CC), accepted(0), active(0),
+                 failedConnects(0), listenFd(-1), epollFd(-1), baseStation(false) {}
+
+    // listens on port and starts the relay thread
+    bool start(bool base) {
+        baseStation = base;
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if(listenFd < 0 || epollFd < 0) {
+            LOG_ERROR(LOG_PROXY, "Failed to create the proxy sockets, errno = {}", errno);
+            return false;
+        }
+        int one = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if(bind(listenFd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0 || ::listen(listenFd, 128) < 0) {
+            LOG_ERROR(LOG_PROXY, "Failed to listen on proxy port {}, errno = {}", port, errno);
+            return false;
+        }
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;      // NULL = the listening socket
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+        std::thread(&TcpProxy::run, this).detach();
+        LOG_INFO(LOG_PROXY, "Proxy listening on port {}", port);
+        return true;
+    }
+
+    // set before start()
+    uint16_t port;
+    std::string congestionControl;
+
+    std::atomic<uint64_t> accepted;
+    std::atomic<uint64_t> active;
+    std::atomic<uint64_t> failedConnects;
+
+private:
+    struct Connection;
+
+    // one end of a relayed connection, buffer holds what was read from it and is not written to the other end yet
+    struct Side {
+        int fd;
+        Connection* connection;
+        bool connected;
+        bool readClosed;        // end of stream read
+        bool writeShut;         // we shut our writing half (the other side's stream ended and all of it was written)
+        size_t start;
+        size_t end;
+        uint8_t buffer[PROXY_BUFFER_SIZE];
+    };
+
+    struct Connection {
+        Side sides[2];          // 0 = accepted, 1 = opened by the proxy
+        bool closed;
+    };
+
+    void run() {
+        struct epoll_event events[PROXY_MAX_EVENTS];
+        std::vector<Connection*> finished;
+        while(true) {
+            int count = epoll_wait(epollFd, events, PROXY_MAX_EVENTS, -1);
+            for(int i = 0; i < count; ++i) {
+                if(events[i].data.ptr == NULL) {
+                    acceptAll();
+                    continue;
+                }
+                Side* side = static_cast<Side*>(events[i].data.ptr);
+                Connection* connection = side->connection;
+                // closed by an earlier event of this round, freed after it
+                if(connection->closed) {
+                    continue;
+                }
+                if(!side->connected && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) != 0) {
+                    int error = 0;
+                    socklen_t length = sizeof(error);
+                    getsockopt(side->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                    if(error != 0) {
+                        failedConnects.fetch_add(1, std::memory_order_relaxed);
+                        LOG_DEBUG(LOG_PROXY, "Proxy failed to connect, errno = {}", error);
+                        close(connection, finished);
+                        continue;
+                    }
+                    side->connected = true;
+                }
+                pump(connection, finished);
+            }
+            for(size_t i = 0; i < finished.size(); ++i) {
+                delete finished[i];
+            }
+            finished.clear();
+        }
+    }
+
+    void acceptAll() {
+        while(true) {
+            int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd < 0) {
+                if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    LOG_WARN(LOG_PROXY, "Proxy failed to accept, errno = {}", errno);
+                }
+                return;
+            }
+            accepted.fetch_add(1, std::memory_order_relaxed);
+            // where the client wanted to go before the redirect
+            struct sockaddr_in destination;
+            struct sockaddr_in local;
+            socklen_t length = sizeof(destination);
+            socklen_t localLength = sizeof(local);
+            if(getsockopt(fd, SOL_IP, SO_ORIGINAL_DST, &destination, &length) < 0
+               || getsockname(fd, reinterpret_cast<struct sockaddr*>(&local), &localLength) < 0
+               // connected to the proxy port directly, relaying would connect to ourselves
+               || (destination.sin_addr.s_addr == local.sin_addr.s_addr && destination.sin_port == local.sin_port)) {
+                LOG_DEBUG(LOG_PROXY, "Proxy connection without a redirected destination, closed");
+                ::close(fd);
+                continue;
+            }
+            int outFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            uint32_t mark = PROXY_MARK;
+            if(outFd < 0 || setsockopt(outFd, SOL_SOCKET, SO_MARK, &mark, sizeof(mark)) < 0
+               || (connect(outFd, reinterpret_cast<struct sockaddr*>(&destination), sizeof(destination)) < 0 && errno != EINPROGRESS)) {
+                failedConnects.fetch_add(1, std::memory_order_relaxed);
+                LOG_DEBUG(LOG_PROXY, "Proxy failed to connect to port {}, errno = {}", ntohs(destination.sin_port), errno);
+                ::close(fd);
+                if(outFd >= 0) {
+                    ::close(outFd);
+                }
+                continue;
+            }
+            // the base station accepts from the link, the mobile station connects over it
+            tuneLinkSide(baseStation ? fd : outFd);
+            Connection* connection = new Connection();
+            connection->closed = false;
+            initSide(connection->sides[0], fd, connection, true);
+            initSide(connection->sides[1], outFd, connection, false);
+            active.fetch_add(1, std::memory_order_relaxed);
+            LOG_DEBUG(LOG_PROXY, "Proxying a connection to port {}, active: {}", ntohs(destination.sin_port), active.load());
+        }
+    }
+
+    void initSide(Side& side, int fd, Connection* connection, bool connected) {
+        side.fd = fd;
+        side.connection = connection;
+        side.connected = connected;
+        side.readClosed = false;
+        side.writeShut = false;
+        side.start = 0;
+        side.end = 0;
+        // edge triggered, pump() reads and writes until the socket would block
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = &side;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void tuneLinkSide(int fd) {
+        int size = PROXY_LINK_SOCKET_BUFFER;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        if(setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, congestionControl.c_str(), congestionControl.size()) < 0) {
+            static bool warned = false;
+            if(!warned) {
+                warned = true;
+                LOG_WARN(LOG_PROXY, "Congestion control not available (errno = {}), the link side uses the default", errno);
+            }
+        }
+    }
+
+    // moves data both ways until nothing moves anymore (with edge triggered events nothing may be left readable)
+    void pump(Connection* connection, std::vector<Connection*>& finished) {
+        bool progress = true;
+        while(progress && !connection->closed) {
+            progress = false;
+            for(int from = 0; from < 2 && !connection->closed; ++from) {
+                Side& source = connection->sides[from];
+                Side& target = connection->sides[1 - from];
+                if(!source.connected || !target.connected) {
+                    continue;
+                }
+                if(!source.readClosed && source.end < PROXY_BUFFER_SIZE) {
+                    ssize_t length = read(source.fd, source.buffer + source.end, PROXY_BUFFER_SIZE - source.end);
+                    if(length > 0) {
+                        source.end += length;
+                        progress = true;
+                    } else if(length == 0) {
+                        source.readClosed = true;
+                        progress = true;
+                    } else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                        close(connection, finished);
+                        break;
+                    }
+                }
+                if(source.start < source.end) {
+                    ssize_t length = send(target.fd, source.buffer + source.start, source.end - source.start, MSG_NOSIGNAL);
+                    if(length > 0) {
+                        source.start += length;
+                        if(source.start == source.end) {
+                            source.start = 0;
+                            source.end = 0;
+                        }
+                        progress = true;
+                    } else if(length < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                        close(connection, finished);
+                        break;
+                    }
+                }
+                // the stream ended and all of it was passed on -> pass the end on
+                if(source.readClosed && source.start == source.end && !target.writeShut) {
+                    shutdown(target.fd, SHUT_WR);
+                    target.writeShut = true;
+                }
+            }
+        }
+        if(!connection->closed && connection->sides[0].writeShut && connection->sides[1].writeShut) {
+            close(connection, finished);
+        }
+    }
+
+    void close(Connection* connection, std::vector<Connection*>& finished) {
+        for(int i = 0; i < 2; ++i) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->sides[i].fd, NULL);
+            ::close(connection->sides[i].fd);
+        }
+        connection->closed = true;
+        finished.push_back(connection);
+        active.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    int listenFd;
+    int epollFd;
+    bool baseStation;
+};
+
+// the one proxy of the station
+inline TcpProxy& tcpProxy() {
+    static TcpProxy instance;
+    return instance;
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef TRAFFIC_CLASS_H
+#define TRAFFIC_CLASS_H
+
+// Traffic classes for partial reliability.
+// Every ip packet read from the interface gets a class, the class decides how long (lifetime) and how many
+// resend rounds (retry budget) the sender keeps trying before it gives up on the packet and aborts it.
+// Real-time traffic would rather lose a packet than get it late, TCP does its own recovery after a while.
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+enum TrafficClass {
+    CLASS_REALTIME,     // VoIP / telemetry / games: DSCP EF, CS4, CS5, AF4x or udp on one of the real-time ports
+    CLASS_TCP,
+    CLASS_DEFAULT,      // everything else (icmp, dns, other udp, ...)
+    CLASS_COUNT
+};
+
+static const char* const trafficClassNames[CLASS_COUNT] = {"realtime", "tcp", "default"};
+
+struct ClassLimits {
+    int lifetimeMs;         // time since the packet was read from the interface
+    int maxResendRounds;    // rounds of resending the missing fragments
+};
+
+struct ClassStats {
+    ClassStats() : sent(0), delivered(0), droppedExpired(0), droppedRetries(0) {}
+
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> delivered;
+    std::atomic<uint64_t> droppedExpired;
+    std::atomic<uint64_t> droppedRetries;
+};
+
+class TrafficPolicy {
+public:
+    TrafficPolicy() {
+        limits[CLASS_REALTIME].lifetimeMs = 100;
+        limits[CLASS_REALTIME].maxResendRounds = 10;
+        limits[CLASS_TCP].lifetimeMs = 2000;
+        limits[CLASS_TCP].maxResendRounds = 200;
+        limits[CLASS_DEFAULT].lifetimeMs = 1000;
+        limits[CLASS_DEFAULT].maxResendRounds = 100;
+        // rtp defaults and the range used by most VoIP / WebRTC clients
+        realtimePorts.push_back(std::make_pair(5004, 5005));
+        realtimePorts.push_back(std::make_pair(16384, 32767));
+    }
+
+    TrafficClass classify(const uint8_t* packet, ssize_t size) const {
+        if(size < 20 || (packet[0] >> 4) != 4) {
+            return CLASS_DEFAULT;
+        }
+        uint8_t dscp = packet[1] >> 2;
+        // EF, CS5, CS4 and AF41-43 are the markings for voice, video and interactive traffic
+        if(dscp == 46 || dscp == 40 || dscp == 32 || dscp == 34 || dscp == 36 || dscp == 38) {
+            return CLASS_REALTIME;
+        }
+        uint8_t protocol = packet[9];
+        if(protocol == 6) {
+            return CLASS_TCP;
+        }
+        size_t headerLength = (packet[0] & 0x0F) * 4;
+        if(protocol == 17 && size >= static_cast<ssize_t>(headerLength + 4)) {
+            uint16_t sourcePort = (packet[headerLength] << 8) | packet[headerLength + 1];
+            uint16_t destinationPort = (packet[headerLength + 2] << 8) | packet[headerLength + 3];
+            if(isRealtimePort(sourcePort) || isRealtimePort(destinationPort)) {
+                return CLASS_REALTIME;
+            }
+        }
+        return CLASS_DEFAULT;
+    }
+
+    // true when the sender should give up on the packet, expired tells if it was the lifetime or the retry budget
+    bool exhausted(TrafficClass trafficClass, std::chrono::steady_clock::time_point packetStart, int resendRounds, bool& expired) const {
+        std::chrono::steady_clock::duration age = std::chrono::steady_clock::now() - packetStart;
+        expired = age > std::chrono::milliseconds(limits[trafficClass].lifetimeMs);
+        return expired || resendRounds >= limits[trafficClass].maxResendRounds;
+    }
+
+    void recordDrop(TrafficClass trafficClass, bool expired) {
+        if(expired) {
+            stats[trafficClass].droppedExpired.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            stats[trafficClass].droppedRetries.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t dropped(TrafficClass trafficClass) const {
+        return stats[trafficClass].droppedExpired.load(std::memory_order_relaxed) + stats[trafficClass].droppedRetries.load(std::memory_order_relaxed);
+    }
+
+    // parses "realtime=100/10,tcp=2000/200" (class=lifetimeMs/maxResendRounds), returns false if the spec is invalid
+    bool configureLimits(const std::string& spec) {
+        std::vector<std::string> items = split(spec, ',');
+        for(size_t i = 0; i < items.size(); ++i) {
+            size_t equals = items[i].find('=');
+            size_t slash = items[i].find('/');
+            if(equals == std::string::npos || slash == std::string::npos || slash < equals) {
+                return false;
+            }
+            int trafficClass = -1;
+            for(int c = 0; c < CLASS_COUNT; ++c) {
+                if(items[i].substr(0, equals) == trafficClassNames[c]) {
+                    trafficClass = c;
+                }
+            }
+            int lifetime = atoi(items[i].substr(equals + 1, slash - equals - 1).c_str());
+            int rounds = atoi(items[i].substr(slash + 1).c_str());
+            if(trafficClass < 0 || lifetime <= 0 || rounds < 0) {
+                return false;
+            }
+            limits[trafficClass].lifetimeMs = lifetime;
+            limits[trafficClass].maxResendRounds = rounds;
+        }
+        return true;
+    }
+
+    // parses "5004-5005,27015" (udp ports treated as real-time), replaces the default ports
+    bool configurePorts(const std::string& spec) {
+        std::vector<std::string> items = split(spec, ',');
+        realtimePorts.clear();
+        for(size_t i = 0; i < items.size(); ++i) {
+            size_t dash = items[i].find('-');
+            int first = atoi(items[i].substr(0, dash).c_str());
+            int last = dash == std::string::npos ? first : atoi(items[i].substr(dash + 1).c_str());
+            if(first <= 0 || last < first || last > 65535) {
+                return false;
+            }
+            realtimePorts.push_back(std::make_pair(static_cast<uint16_t>(first), static_cast<uint16_t>(last)));
+        }
+        return true;
+    }
+
+    ClassLimits limits[CLASS_COUNT];
+    ClassStats stats[CLASS_COUNT];
+
+private:
+    bool isRealtimePort(uint16_t port) const {
+        for(size_t i = 0; i < realtimePorts.size(); ++i) {
+            if(port >= realtimePorts[i].first && port <= realtimePorts[i].second) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static std::vector<std::string> split(const std::string& text, char separator) {
+        std::vector<std::string> items;
+        size_t begin = 0;
+        while(begin <= text.size()) {
+            size_t end = text.find(separator, begin);
+            if(end == std::string::npos) {
+                end = text.size();
+            }
+            if(end > begin) {
+                items.push_back(text.substr(begin, end - begin));
+            }
+            begin = end + 1;
+        }
+        return items;
+    }
+
+    std::vector<std::pair<uint16_t, uint16_t> > realtimePorts;
+};
+
+// the one traffic policy of the program
+inline TrafficPolicy& trafficPolicy() {
+    static TrafficPolicy instance;
+    return instance;
+}
+
+#endif
@@ -0,0 +1,447 @@
+#ifndef TUN_RING_H
+#define TUN_RING_H
+
+// Batched tun0 I/O on io_uring (raw system calls, liburing is not needed).
+// The tun stages of pipeline.h cost a poll and a read for every packet read and a write for every packet written, on
+// the slow cores of the raspberry that adds up with many small packets (tcp acks, voip). With the ring:
+// - the tun reader keeps a read outstanding in up to TUN_RING_READS free buffers of the outgoing pipe, the buffers are
+//   registered with the ring once (the kernel does not map them for every read) and one system call takes all the
+//   reads completed meanwhile and submits the reads of the buffers the sender gave back
+// - the tun writer takes all the reassembled packets waiting and writes them with one system call
+// - with --tun-queues tun0 is a multi queue interface and the writer writes to a queue of its own, so the two threads
+//   do not share one file, a tiny bpf program steers all packets leaving tun0 to the queue of the reader (by default
+//   the kernel sends the packets of a flow to the queue its last packet was written to)
+// Kernels without io_uring (or older than 5.11) and --no-io-uring use the poll and read / write stages of pipeline.h.
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <linux/bpf.h>
+#include <linux/io_uring.h>
+#include "pipeline.h"
+#include "hotRestart.h"
+#include "ackFilter.h"
+#include "asyncLog.h"
+
+// reads kept outstanding by the tun reader (at most all the buffers of the pipe)
+#define TUN_RING_READS 8
+// packets the tun writer writes with one system call
+#define TUN_RING_BATCH 8
+// submission queue entries, room for the reads and their cancellation
+#define TUN_RING_ENTRIES 32
+// user data of the requests without a buffer
+#define TUN_RING_NO_BUFFER (~0ULL)
+
+// an io_uring with its mapped submission and completion queues, used by one thread
+class IoRing {
+public:
+    IoRing() : fd(-1), sqRing(NULL), cqRing(NULL), sqes(NULL), sqRingSize(0), cqRingSize(0), sqesSize(0),
+               sqLocalTail(0), toSubmit(0) {}
+
+    ~IoRing() {
+        if(sqes != NULL) {
+            munmap(sqes, sqesSize);
+        }
+        if(cqRing != NULL && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if(sqRing != NULL) {
+            munmap(sqRing, sqRingSize);
+        }
+        if(fd >= 0) {
+            close(fd);
+        }
+    }
+
+    // false (with errno) when the kernel has no usable io_uring
+    bool setup(unsigned entries) {
+#ifdef __NR_io_uring_setup
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if(fd < 0) {
+            return false;
+        }
+        // the wait with a timeout needs 5.11
+        if((params.features & IORING_FEAT_EXT_ARG) == 0) {
+            errno = ENOSYS;
+            return false;
+        }
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if(single) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = map(sqRingSize, IORING_OFF_SQ_RING);
+        cqRing = single ? sqRing : map(cqRingSize, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = static_cast<struct io_uring_sqe*>(map(sqesSize, IORING_OFF_SQES));
+        if(sqRing == NULL || cqRing == NULL || sqes == NULL) {
+            return false;
+        }
+        uint8_t* sq = static_cast<uint8_t*>(sqRing);
+        uint8_t* cq = static_cast<uint8_t*>(cqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqEntries = params.sq_entries;
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+        sqLocalTail = *sqTail;
+        return true;
+#else
+        (void)entries;
+        errno = ENOSYS;
+        return false;
+#endif
+    }
+
+    // the data buffers of the pipe, a fixed read / write names one by its index in the storage
+    bool registerBuffers(PacketPipe& pipe) {
+        std::vector<struct iovec> buffers(pipe.storage.size());
+        for(size_t i = 0; i < buffers.size(); ++i) {
+            buffers[i].iov_base = pipe.storage[i].data;
+            buffers[i].iov_len = PACKET_BUFFER_SIZE;
+        }
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, &buffers[0], buffers.size()) == 0;
+    }
+
+    // a fixed read or write of a pipe buffer, false if the submission queue is full
+    bool prepare(uint8_t opcode, int file, PacketPipe& pipe, PacketBuffer* packet, unsigned length) {
+        struct io_uring_sqe* sqe = next();
+        if(sqe == NULL) {
+            return false;
+        }
+        uint64_t index = packet - &pipe.storage[0];
+        sqe->opcode = opcode;
+        sqe->fd = file;
+        sqe->addr = reinterpret_cast<uintptr_t>(packet->data);
+        sqe->len = length;
+        sqe->buf_index = static_cast<uint16_t>(index);
+        sqe->user_data = index;
+        return true;
+    }
+
+    // cancels the request with the user data
+    bool cancel(uint64_t userData) {
+        struct io_uring_sqe* sqe = next();
+        if(sqe == NULL) {
+            return false;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = userData;
+        sqe->user_data = TUN_RING_NO_BUFFER;
+        return true;
+    }
+
+    // submits what was prepared and waits for waitFor completions, at most timeoutMs (-1 = no limit)
+    bool submitAndWait(unsigned waitFor, int timeoutMs) {
+        __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+        struct __kernel_timespec timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = reinterpret_cast<uintptr_t>(&timeout);
+        unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+        if(waitFor > 0 && timeoutMs >= 0) {
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+        long result = syscall(__NR_io_uring_enter, fd, toSubmit, waitFor, flags, (flags & IORING_ENTER_EXT_ARG) != 0 ? &arg : NULL, sizeof(arg));
+        if(result >= 0) {
+            toSubmit -= std::min<unsigned>(toSubmit, static_cast<unsigned>(result));
+            return true;
+        }
+        // the timeout or a signal, the completions there are are reaped anyway
+        return errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY;
+    }
+
+    // gives every completion to handle(userData, result), returns their number
+    template <typename Handler>
+    unsigned reap(Handler handle) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for(; head != tail; ++head, ++count) {
+            const struct io_uring_cqe& cqe = cqes[head & cqMask];
+            handle(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+private:
+    void* map(size_t size, off_t offset) {
+        void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return memory == MAP_FAILED ? NULL : memory;
+    }
+
+    struct io_uring_sqe* next() {
+        if(sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+            return NULL;
+        }
+        unsigned index = sqLocalTail & sqMask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        ++sqLocalTail;
+        ++toSubmit;
+        return sqe;
+    }
+
+    int fd;
+    void* sqRing;
+    void* cqRing;
+    struct io_uring_sqe* sqes;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned* sqArray;
+    unsigned sqLocalTail;
+    unsigned toSubmit;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+};
+
+class TunRing {
+public:
+    TunRing() : enabled(true), multiQueue(false), readCalls(0), packetsRead(0), writeCalls(0), packetsWritten(0) {}
+
+    // the fd the tun writer writes to: with --tun-queues a queue of its own, else the one of the reader
+    int writerQueue(const char* ifname, int tunFd) {
+        if(!multiQueue) {
+            return tunFd;
+        }
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        // taken over from a process that made tun0 without queues
+        if(ioctl(tunFd, TUNGETIFF, &ifr) < 0 || (ifr.ifr_flags & IFF_MULTI_QUEUE) == 0) {
+            LOG_WARN(LOG_MAIN, "tun0 has a single queue, the tun writer shares it with the reader");
+            return tunFd;
+        }
+        if(!steerToFirstQueue(tunFd)) {
+            LOG_WARN(LOG_MAIN, "Failed to steer the packets of tun0 to the reader's queue (errno = {}), the queues are not used", errno);
+            return tunFd;
+        }
+        int fd = open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+        memset(&ifr, 0, sizeof(ifr));
+        ifr.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+        strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+        if(fd < 0 || ioctl(fd, TUNSETIFF, &ifr) < 0) {
+            LOG_WARN(LOG_MAIN, "Failed to open a queue of tun0 for the tun writer, errno = {}", errno);
+            if(fd >= 0) {
+                close(fd);
+            }
+            return tunFd;
+        }
+        return fd;
+    }
+
+    // set before the threads start
+    bool enabled;       // --no-io-uring clears it
+    bool multiQueue;    // --tun-queues
+
+    std::atomic<uint64_t> readCalls;
+    std::atomic<uint64_t> packetsRead;
+    std::atomic<uint64_t> writeCalls;
+    std::atomic<uint64_t> packetsWritten;
+
+private:
+    // a bpf program returning queue 0 for every packet
+    static bool steerToFirstQueue(int tunFd) {
+        struct bpf_insn program[2];
+        memset(program, 0, sizeof(program));
+        program[0].code = BPF_ALU64 | BPF_MOV | BPF_K;     // r0 = 0
+        program[0].dst_reg = BPF_REG_0;
+        program[1].code = BPF_JMP | BPF_EXIT;
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+        attr.insns = reinterpret_cast<uintptr_t>(program);
+        attr.insn_cnt = 2;
+        attr.license = reinterpret_cast<uintptr_t>("GPL");
+        int programFd = static_cast<int>(syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr)));
+        if(programFd < 0) {
+            return false;
+        }
+        // tun0 keeps its own reference to the program
+        bool steered = ioctl(tunFd, TUNSETSTEERINGEBPF, &programFd) >= 0;
+        close(programFd);
+        return steered;
+    }
+};
+
+// the io_uring settings and counters of tun0
+inline TunRing& tunRing() {
+    static TunRing instance;
+    return instance;
+}
+
+// tunReader on the ring
+inline void tunRingReader(int tunFd, PacketPipe& pipe, PacketCheck isIpPacket, PacketBypass bypass) {
+    IoRing ring;
+    if(!tunRing().enabled || !ring.setup(TUN_RING_ENTRIES) || !ring.registerBuffers(pipe)) {
+        if(tunRing().enabled) {
+            LOG_WARN(LOG_MAIN, "io_uring not available (errno = {}), tun0 is read with poll and read", errno);
+        }
+        tunReader(tunFd, pipe, isIpPacket, bypass);
+        return;
+    }
+    // buffers taken from the pipe without a read outstanding (a read failed or its packet was not an ip packet),
+    // they can not go back to the free ones, the sender is the one pushing there
+    std::vector<PacketBuffer*> spare;
+    bool reading[PIPELINE_BUFFERS] = {};
+    unsigned outstanding = 0;
+    bool parking = false;
+    while(true) {
+        // a new process takes over -> the outstanding reads are cancelled, what they read already is passed on
+        if(!parking && hotRestart().shouldPark(STAGE_TUN_READER)) {
+            parking = true;
+            for(unsigned i = 0; i < PIPELINE_BUFFERS; ++i) {
+                if(reading[i]) {
+                    ring.cancel(i);
+                }
+            }
+        }
+        if(parking && outstanding == 0) {
+            hotRestart().park(STAGE_TUN_READER);
+            parking = false;
+            continue;
+        }
+        if(!parking) {
+            while(outstanding < TUN_RING_READS) {
+                PacketBuffer* packet;
+                if(!spare.empty()) {
+                    packet = spare.back();
+                    spare.pop_back();
+                } else if(outstanding == 0) {
+                    // the sender is behind, the packets wait in tun0 (its queue is the one that overflows)
+                    packet = pipe.freeBuffers.pop(PIPELINE_POLL_MS);
+                } else {
+                    packet = pipe.freeBuffers.tryPop();
+                }
+                if(packet == NULL) {
+                    break;
+                }
+                ring.prepare(IORING_OP_READ_FIXED, tunFd, pipe, packet, PACKET_BUFFER_SIZE);
+                reading[packet - &pipe.storage[0]] = true;
+                ++outstanding;
+            }
+            if(outstanding == 0) {
+                continue;
+            }
+        }
+        if(!ring.submitAndWait(1, PIPELINE_POLL_MS)) {
+            LOG_ERROR(LOG_MAIN, "Failed to read from TUN device over io_uring, errno = {}", errno);
+            return;
+        }
+        tunRing().readCalls.fetch_add(1, std::memory_order_relaxed);
+        bool failed = false;
+        ring.reap([&](uint64_t userData, int result) {
+            if(userData == TUN_RING_NO_BUFFER) {
+                return;
+            }
+            PacketBuffer* packet = &pipe.storage[userData];
+            reading[userData] = false;
+            --outstanding;
+            if(result <= 0) {
+                if(result != -ECANCELED && result != -EINTR && result != -EAGAIN) {
+                    LOG_ERROR(LOG_MAIN, "Failed to read from TUN device, errno = {}", -result);
+                    failed = true;
+                }
+                spare.push_back(packet);
+                return;
+            }
+            // check that the packet is ip packet
+            if(!isIpPacket(packet->data, result)) {
+                spare.push_back(packet);
+                return;
+            }
+            packet->length = static_cast<uint16_t>(result);
+            // the traffic class decides for how long and how many times the sender tries to deliver the packet
+            packet->trafficClass = trafficPolicy().classify(packet->data, result);
+            packet->readAt = std::chrono::steady_clock::now();
+            if(bypass(packet)) {
+                spare.push_back(packet);
+                return;
+            }
+            // a pure tcp ack still waiting in the pipe is dropped when this one acknowledges more
+            ackFilter().queue(packet);
+            pipe.packets.push(packet);
+            tunRing().packetsRead.fetch_add(1, std::memory_order_relaxed);
+        });
+        if(failed) {
+            return;
+        }
+    }
+}
+
+// tunWriter on the ring
+inline void tunRingWriter(int tunFd, PacketPipe& pipe, PacketOpen openPacket) {
+    IoRing ring;
+    if(!tunRing().enabled || !ring.setup(TUN_RING_ENTRIES) || !ring.registerBuffers(pipe)) {
+        tunWriter(tunFd, pipe, openPacket);
+        return;
+    }
+    while(true) {
+        PacketBuffer* packet = pipe.packets.pop(PIPELINE_POLL_MS);
+        if(packet == NULL) {
+            if(hotRestart().shouldPark(STAGE_TUN_WRITER)) {
+                hotRestart().park(STAGE_TUN_WRITER);
+            }
+            continue;
+        }
+        // all the packets waiting, written in their order (a write to tun0 never blocks, the ring does them in turn)
+        unsigned count = 0;
+        do {
+            // first we check if the received fragments put together an actual ip packet
+            if(openPacket(packet)) {
+                LOG_DEBUG(LOG_RECEIVE, "Received data form an ip packet, {} bytes", packet->length);
+                ring.prepare(IORING_OP_WRITE_FIXED, tunFd, pipe, packet, packet->length);
+                ++count;
+            } else {
+                LOG_WARN(LOG_RECEIVE, "Received data are not of an IP packet, {} bytes", packet->length);
+                pipe.freeBuffers.push(packet);
+            }
+        } while(count < TUN_RING_BATCH && (packet = pipe.packets.tryPop()) != NULL);
+        unsigned done = 0;
+        while(done < count) {
+            if(!ring.submitAndWait(count - done, -1)) {
+                LOG_ERROR(LOG_MAIN, "Failed to write to TUN device over io_uring, errno = {}", errno);
+                return;
+            }
+            tunRing().writeCalls.fetch_add(1, std::memory_order_relaxed);
+            done += ring.reap([&](uint64_t userData, int result) {
+                if(result < 0) {
+                    LOG_ERROR(LOG_RECEIVE, "Failed to write to TUN device, errno = {}", -result);
+                }
+                pipe.freeBuffers.push(&pipe.storage[userData]);
+            });
+        }
+        tunRing().packetsWritten.fetch_add(count, std::memory_order_relaxed);
+    }
+}
+
+#endif
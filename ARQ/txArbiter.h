@@ -0,0 +1,469 @@
+#ifndef TX_ARBITER_H
+#define TX_ARBITER_H
+
+// The one thread that writes to the send radio. The sender (data, aborts) and the receiver (acks, session frames) only
+// queue their frames, so they never touch the radio at the same time (SPI and the radio state are not thread safe),
+// and an acknowledgement does not wait behind the data of a whole ip packet:
+// - four queues by priority, acknowledgements (ack / nak / final) > control frames > datagrams of the fast path
+//   (fastPath.h) > data
+// - before every frame the arbiter takes all the acknowledgements queued and sends them together in one frame
+//   (a frame whose bytes all have the most significant bit set, see controlFrames.h), so an ack waits at most for
+//   the frame being on air
+// - with --piggyback the acknowledgements ride in the trailer of outgoing data frames instead (see piggyback.h) and
+//   a frame of their own is sent only when they waited too long
+// - the data frames (and the datagrams) are paced to the rate the receiver of the peer drains its radio (see flowControl.h): as many back
+//   to back as its RX FIFO holds, then one per drain time, and at least the gap of the pacer apart (see txPacer.h)
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "frameCapture.h"
+#include "piggyback.h"
+#include "controlFrames.h"
+#include "realtime.h"
+
+// frames per queue (power of two)
+#define TX_QUEUE_SIZE 64
+// data frames queued ahead (the sender waits when there are more), a short queue keeps the resends of the sender current
+#define TX_DATA_QUEUE_LIMIT 8
+#define TX_FRAME_SIZE LINK_FRAME_MAX
+// data frames that may go back to back to a paced receiver, its RX FIFO holds as many
+#define TX_PACING_BURST 3
+
+enum TxPriority {
+    TX_PRIORITY_ACK,
+    TX_PRIORITY_CONTROL,
+    TX_PRIORITY_DATAGRAM,
+    TX_PRIORITY_DATA,
+    TX_PRIORITY_COUNT
+};
+
+struct TxFrame {
+    uint8_t length;
+    uint8_t data[TX_FRAME_SIZE];
+    uint8_t* shared;                // a frame of a packet buffer sent instead of data (not copied), NULL if none
+    std::atomic<int>* references;   // of that packet buffer, released once the frame is on air
+};
+
+// bounded multi-producer single consumer queue (each cell has a sequence number telling whose turn it is)
+class TxQueue {
+public:
+    TxQueue() : enqueuePos(0), dequeuePos(0) {
+        for(size_t i = 0; i < TX_QUEUE_SIZE; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(const void* frame, uint8_t length, uint8_t* shared, std::atomic<int>* references) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true) {
+            cell = &cells[pos & (TX_QUEUE_SIZE - 1)];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if(diff == 0) {
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if(diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->frame.length = length;
+        cell->frame.shared = shared;
+        cell->frame.references = references;
+        if(shared == NULL) {
+            memcpy(cell->frame.data, frame, length);
+        }
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // only the arbiter thread pops
+    bool pop(TxFrame& out) {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Cell* cell = &cells[pos & (TX_QUEUE_SIZE - 1)];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        if(static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0) {
+            return false;
+        }
+        out = cell->frame;
+        cell->sequence.store(pos + TX_QUEUE_SIZE, std::memory_order_release);
+        dequeuePos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        TxFrame frame;
+    };
+
+    Cell cells[TX_QUEUE_SIZE];
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+};
+
+class TxArbiter {
+public:
+    TxArbiter() : frameSize(RADIO_FRAME_SIZE), piggyback(false), piggybackUs(PIGGYBACK_DEFAULT_US), acksCoalesced(0), acksPiggybacked(0), queueFull(0),
+                  pacedFrames(0), pendingCount(0), oldestPendingNs(0), drainNs(0), gapNs(0), nextDataNs(0), lastDataNs(0), dataWaited(false),
+                  sleeping(false), senderWaiting(false) {
+        eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        dataSentFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(eventFd < 0 || dataSentFd < 0) {
+            perror("Failed to create eventfd");
+        }
+        for(int i = 0; i < TX_PRIORITY_COUNT; ++i) {
+            queued[i].store(0);
+            sent[i].store(0);
+        }
+    }
+
+    // queues a frame, acknowledgements and control frames are dropped (and counted) if their queue is full,
+    // data waits for space (only the sender queues data)
+    bool send(TxPriority priority, const void* frame, uint8_t length) {
+        if(length > frameSize) {
+            length = frameSize;
+        }
+        return enqueue(priority, frame, length, NULL, NULL);
+    }
+
+    // queues a frame of the arena of a packet buffer without copying it, it is counted in references until it is on air
+    bool sendShared(TxPriority priority, uint8_t* frame, uint8_t length, std::atomic<int>& references) {
+        references.fetch_add(1, std::memory_order_relaxed);
+        if(!enqueue(priority, frame, length, frame, &references)) {
+            references.fetch_sub(1, std::memory_order_release);
+            return false;
+        }
+        return true;
+    }
+
+    // the receiver of the peer takes this long to drain a frame, 0 = no pacing (the receiver thread sets it)
+    void setDrainUs(int us) {
+        drainNs.store(static_cast<uint64_t>(us) * 1000, std::memory_order_relaxed);
+    }
+
+    // the least time between two data frames, 0 = none (the sender thread sets it, see txPacer.h)
+    void setGapUs(int us) {
+        gapNs.store(static_cast<uint64_t>(us) * 1000, std::memory_order_relaxed);
+    }
+
+    int gapUs() const {
+        return static_cast<int>(gapNs.load(std::memory_order_relaxed) / 1000);
+    }
+
+    int drainUs() const {
+        return static_cast<int>(drainNs.load(std::memory_order_relaxed) / 1000);
+    }
+
+    // the frames of the priority queued and not on air yet
+    uint64_t waiting(TxPriority priority) const {
+        return queued[priority].load(std::memory_order_relaxed) - sent[priority].load(std::memory_order_acquire);
+    }
+
+    // waits until all the data frames queued so far are on air (the sender measures its ack timeout from there)
+    void flushData() {
+        uint64_t target = queued[TX_PRIORITY_DATA].load(std::memory_order_relaxed);
+        waitForData(DataSent(sent[TX_PRIORITY_DATA], target));
+    }
+
+    // waits until the frames of a packet buffer queued with sendShared are on air, it may be reused then
+    void waitReleased(const std::atomic<int>& references) {
+        waitForData(Released(references));
+    }
+
+    // the arbiter thread, the only one writing to the radio
+    template <typename Radio>
+    void run(Radio& radio) {
+        TxFrame frame;
+        while(true) {
+            // a control frame may report on the fragments that acknowledgements queued before it acknowledge (e.g. a
+            // corrupted packet), so it must not overtake them: only the control frames seen before collecting are sent
+            uint64_t controlQueued = queued[TX_PRIORITY_CONTROL].load(std::memory_order_acquire);
+            collectAcks();
+            bool controlNext = controlQueued != sent[TX_PRIORITY_CONTROL].load(std::memory_order_relaxed);
+            // the acknowledgements first, all that are pending in as few frames as possible (with piggybacking only
+            // when they waited long enough for a data frame, would not fit into the next one anyway, or a control frame
+            // is next)
+            if(pendingCount != 0 && (!piggyback || nowNs() - oldestPendingNs >= static_cast<uint64_t>(piggybackUs) * 1000
+                                     || pendingCount > PIGGYBACK_BITMAP_BITS + 1 || controlNext)) {
+                sendPendingAcks(radio);
+                continue;
+            }
+            // then one frame of the highest priority that has one (data only when the pacing lets it), and the acks are
+            // looked at again
+            uint64_t dataDelayNs = pacingDelayNs();
+            bool sentOne = false;
+            for(int priority = TX_PRIORITY_CONTROL; priority < TX_PRIORITY_COUNT && !sentOne; ++priority) {
+                if(priority >= TX_PRIORITY_DATAGRAM && dataDelayNs != 0) {
+                    dataWaited = dataWaited || queued[priority].load(std::memory_order_relaxed) != sent[priority].load(std::memory_order_relaxed);
+                    continue;
+                }
+                if((priority != TX_PRIORITY_CONTROL || controlNext) && queues[priority].pop(frame)) {
+                    uint8_t* bytes = frame.shared != NULL ? frame.shared : frame.data;
+                    if(piggyback && priority == TX_PRIORITY_DATA) {
+                        attachAcks(bytes, frame.length);
+                    }
+                    captureWrite(radio, CAPTURE_RADIO_SEND, bytes, frame.length);
+                    if(frame.references != NULL) {
+                        frame.references->fetch_sub(1, std::memory_order_release);
+                    }
+                    sent[priority].fetch_add(1, std::memory_order_release);
+                    if(priority >= TX_PRIORITY_DATAGRAM) {
+                        paced();
+                    }
+                    if(priority == TX_PRIORITY_DATA) {
+                        wakeSender();
+                    }
+                    sentOne = true;
+                }
+            }
+            if(!sentOne) {
+                idle(dataDelayNs);
+            }
+        }
+    }
+
+    uint64_t sentFrames(TxPriority priority) const {
+        return sent[priority].load(std::memory_order_relaxed);
+    }
+
+    // set before the arbiter thread starts
+    int frameSize;      // of the link, the geometry of the core sets it (see startArqCore and frameGeometry.h)
+    bool piggyback;
+    int piggybackUs;
+
+    std::atomic<uint64_t> acksCoalesced;    // acknowledgements that shared a frame with an earlier one, or were duplicates
+    std::atomic<uint64_t> acksPiggybacked;  // acknowledgements sent in the trailer of a data frame
+    std::atomic<uint64_t> queueFull;
+    std::atomic<uint64_t> pacedFrames;      // data frames that waited for the receiver of the peer to drain its radio
+
+private:
+    bool enqueue(TxPriority priority, const void* frame, uint8_t length, uint8_t* shared, std::atomic<int>* references) {
+        if(priority == TX_PRIORITY_DATA) {
+            uint64_t ahead = queued[priority].load(std::memory_order_relaxed);
+            waitForData(DataSent(sent[priority], ahead >= TX_DATA_QUEUE_LIMIT ? ahead + 1 - TX_DATA_QUEUE_LIMIT : 0));
+        }
+        if(!queues[priority].push(frame, length, shared, references)) {
+            queueFull.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        queued[priority].fetch_add(1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    static uint64_t nowNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // moves the queued acknowledgements to the pending ones, the same acknowledgement twice says nothing new
+    void collectAcks() {
+        TxFrame frame;
+        while(queues[TX_PRIORITY_ACK].pop(frame)) {
+            sent[TX_PRIORITY_ACK].fetch_add(1, std::memory_order_relaxed);
+            for(uint8_t i = 0; i < frame.length; ++i) {
+                bool duplicate = false;
+                for(uint8_t j = 0; j < pendingCount && !duplicate; ++j) {
+                    duplicate = pending[j] == frame.data[i];
+                }
+                if(duplicate || pendingCount == TX_QUEUE_SIZE) {
+                    acksCoalesced.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if(pendingCount == 0) {
+                    oldestPendingNs = nowNs();
+                }
+                pending[pendingCount++] = frame.data[i];
+            }
+        }
+    }
+
+    template <typename Radio>
+    void sendPendingAcks(Radio& radio) {
+        for(int first = 0; first < pendingCount; first += frameSize) {
+            uint8_t count = static_cast<uint8_t>(std::min<int>(frameSize, pendingCount - first));
+            captureWrite(radio, CAPTURE_RADIO_SEND, pending + first, count);
+            acksCoalesced.fetch_add(count - 1, std::memory_order_relaxed);
+        }
+        pendingCount = 0;
+    }
+
+    // fills the trailer of a data frame with pending acknowledgements (sorted, so one bitmap covers the most of them)
+    void attachAcks(uint8_t* frame, uint8_t& length) {
+        memset(frame + length, 0, frameSize - length);
+        length = static_cast<uint8_t>(frameSize);
+        std::sort(pending, pending + pendingCount);
+        uint8_t packed = packAckTrailer(pending, pendingCount, frame + frameSize - PIGGYBACK_TRAILER_SIZE);
+        acksPiggybacked.fetch_add(packed, std::memory_order_relaxed);
+        if(pendingCount != 0) {
+            oldestPendingNs = nowNs();
+        }
+    }
+
+    // how long the next data frame has to wait for the receiver of the peer (0 = it may go now): each frame moves the
+    // time of the next one a drain time on, up to TX_PACING_BURST frames may be ahead of it
+    uint64_t pacingDelayNs() const {
+        uint64_t drain = drainNs.load(std::memory_order_relaxed);
+        uint64_t gap = gapNs.load(std::memory_order_relaxed);
+        if(drain == 0 && gap == 0) {
+            return 0;
+        }
+        uint64_t earliest = nextDataNs > drain * (TX_PACING_BURST - 1) ? nextDataNs - drain * (TX_PACING_BURST - 1) : 0;
+        // the gap of the pacer has no burst
+        earliest = std::max(earliest, lastDataNs + gap);
+        uint64_t now = nowNs();
+        return now >= earliest ? 0 : earliest - now;
+    }
+
+    void paced() {
+        uint64_t drain = drainNs.load(std::memory_order_relaxed);
+        uint64_t now = nowNs();
+        if(drain != 0) {
+            nextDataNs = std::max(nextDataNs, now) + drain;
+        }
+        lastDataNs = now;
+        if(dataWaited) {
+            pacedFrames.fetch_add(1, std::memory_order_relaxed);
+            dataWaited = false;
+        }
+    }
+
+    void wake() {
+        // pairs with the fence in idle(): either the arbiter sees the frame, or we see it sleeping
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sleeping.load(std::memory_order_relaxed)) {
+            uint64_t one = 1;
+            ssize_t written = write(eventFd, &one, sizeof(one));
+            (void)written;
+        }
+    }
+
+    // the conditions the sender waits for, they only change when a data frame went on air
+    struct DataSent {
+        DataSent(const std::atomic<uint64_t>& counter, uint64_t target) : counter(counter), target(target) {}
+        bool operator()() const { return counter.load(std::memory_order_acquire) >= target; }
+        const std::atomic<uint64_t>& counter;
+        uint64_t target;
+    };
+
+    struct Released {
+        explicit Released(const std::atomic<int>& references) : references(references) {}
+        bool operator()() const { return references.load(std::memory_order_acquire) == 0; }
+        const std::atomic<int>& references;
+    };
+
+    // the sender sleeps until the arbiter sent data frames enough for it. Yielding instead would spin under --rt: the
+    // sender runs at SCHED_FIFO and sched_yield does not give the cpu to the lower threads sharing it, while the
+    // arbiter sleeps out the pacing gap or the acknowledgement deadline.
+    template <typename Done>
+    void waitForData(const Done& done) {
+        while(!done()) {
+            // pairs with the fence in wakeSender(): either we see the frame on air, or the arbiter sees us waiting
+            senderWaiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(!done()) {
+                struct pollfd readable;
+                readable.fd = dataSentFd;
+                readable.events = POLLIN;
+                poll(&readable, 1, 100);
+                uint64_t count;
+                ssize_t length = read(dataSentFd, &count, sizeof(count));
+                (void)length;
+            }
+            senderWaiting.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    void wakeSender() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(senderWaiting.load(std::memory_order_relaxed)) {
+            uint64_t one = 1;
+            ssize_t written = write(dataSentFd, &one, sizeof(one));
+            (void)written;
+        }
+    }
+
+    // sleeps until a frame is queued, the pending acknowledgements are due or the paced data may go (dataDelayNs)
+    void idle(uint64_t dataDelayNs) {
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool empty = true;
+        for(int priority = 0; priority < TX_PRIORITY_COUNT && empty; ++priority) {
+            if(priority >= TX_PRIORITY_DATAGRAM && dataDelayNs != 0) {
+                continue;
+            }
+            empty = queued[priority].load(std::memory_order_relaxed) == sent[priority].load(std::memory_order_relaxed);
+        }
+        if(empty) {
+            // pending acknowledgements wait for a data frame only until their deadline
+            uint64_t timeoutNs = 100000000ULL;
+            uint64_t deadlineNs = 0;
+            if(pendingCount != 0) {
+                uint64_t now = nowNs();
+                uint64_t waited = now - oldestPendingNs;
+                uint64_t limit = static_cast<uint64_t>(piggybackUs) * 1000;
+                timeoutNs = waited < limit ? limit - waited : 0;
+                deadlineNs = now + timeoutNs;
+            }
+            if(dataDelayNs != 0 && dataDelayNs < timeoutNs) {
+                timeoutNs = dataDelayNs;
+                deadlineNs = nowNs() + timeoutNs;
+            }
+            struct timespec timeout;
+            timeout.tv_sec = timeoutNs / 1000000000ULL;
+            timeout.tv_nsec = timeoutNs % 1000000000ULL;
+            struct pollfd readable;
+            readable.fd = eventFd;
+            readable.events = POLLIN;
+            // how late the deadline of the acknowledgements or of the paced data woke us up (see realtime.h)
+            if(ppoll(&readable, 1, &timeout, NULL) == 0 && deadlineNs != 0) {
+                uint64_t now = nowNs();
+                realtime().latency[RT_TRANSMITTER].record(now > deadlineNs ? now - deadlineNs : 0);
+            }
+            uint64_t count;
+            ssize_t length = read(eventFd, &count, sizeof(count));
+            (void)length;
+        }
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    TxQueue queues[TX_PRIORITY_COUNT];
+    std::atomic<uint64_t> queued[TX_PRIORITY_COUNT];
+    std::atomic<uint64_t> sent[TX_PRIORITY_COUNT];
+    // acknowledgements taken from the queue, not sent yet (only the arbiter thread uses these)
+    uint8_t pending[TX_QUEUE_SIZE];
+    uint8_t pendingCount;
+    uint64_t oldestPendingNs;
+    std::atomic<uint64_t> drainNs;
+    std::atomic<uint64_t> gapNs;
+    uint64_t nextDataNs;    // when the next data frame may go, TX_PACING_BURST - 1 drain times earlier (arbiter thread)
+    uint64_t lastDataNs;
+    bool dataWaited;
+    std::atomic<bool> sleeping;
+    int eventFd;
+    // the sender waits for data frames to go on air (only the sender queues data)
+    std::atomic<bool> senderWaiting;
+    int dataSentFd;
+};
+
+// the one transmit arbiter of the send radio
+inline TxArbiter& txArbiter() {
+    static TxArbiter instance;
+    return instance;
+}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef TX_PACER_H
+#define TX_PACER_H
+
+// The gap between the data frames the tx arbiter sends, so the sender does not outrun the receiver of the peer.
+// The nRF24 of the peer holds 3 frames, its receiver drains them between writing its own acks on the other radio, so
+// back to back frames can fill the RX FIFO and the ones behind are lost. The peer counts how often it found its RX
+// FIFO full (the status register, see receiveData) and tells us in its credits (see flowControl.h):
+// - the peer found its FIFO full again -> the gap doubles (at least by TX_PACER_STEP_US, at most TX_PACER_MAX_US), once
+//   per TX_PACER_HOLD_FRAMES frames, the reports of one overload do not add up
+// - the loss the sender measured over TX_PACER_WINDOW_FRAMES frames went up clearly -> the gap grows by a step, loss
+//   from the gap being too small grows when the gap shrinks, interference does not care
+// - a window without either -> the gap shrinks by a quarter (at least a step), down to the gap of --tx-gap-us
+// With --tx-gap-fixed the gap stays as configured. The drain time of the peer paces the frames as well (txArbiter.h).
+
+#include <atomic>
+#include <algorithm>
+#include <stdint.h>
+#include "txArbiter.h"
+#include "asyncLog.h"
+
+#define TX_PACER_STEP_US 20
+#define TX_PACER_MAX_US 1000
+// frames sent per look at the loss
+#define TX_PACER_WINDOW_FRAMES 200
+#define TX_PACER_HOLD_FRAMES 50
+// the loss of a window has gone up when it is over TX_PACER_LOSS_RISE times the one of the previous window plus
+// TX_PACER_LOSS_MIN (the loss of 200 frames varies by about 1.5 % at 5 % loss)
+#define TX_PACER_LOSS_RISE 1.25
+#define TX_PACER_LOSS_MIN 0.02
+
+class TxPacer {
+public:
+    TxPacer() : gapUs(0), adaptive(true), peerFifoFull(0), raised(0), lowered(0), currentUs(0), lastPeerFifoFull(0), synced(false),
+                heldBack(false), peerReported(false), windowFrames(0), windowResends(0), lastLoss(0) {}
+
+    // ---- receiver thread ----
+
+    // the count of RX FIFO full events (modulo 256) in the credits of the peer
+    void onPeerFifoFull(uint8_t count) {
+        peerFifoFull.store(count, std::memory_order_relaxed);
+        peerReported.store(true, std::memory_order_release);
+    }
+
+    // ---- sender thread ----
+
+    // the gap the arbiter keeps from the first packet on
+    void start() {
+        currentUs = gapUs;
+        txArbiter().setGapUs(currentUs);
+    }
+
+    // called for every packet: frames sent the first time and frames resent
+    void record(int frames, int resends) {
+        if(!adaptive) {
+            return;
+        }
+        // the peer found its FIFO full since the last packet -> we back off right away
+        if(peerReported.load(std::memory_order_acquire)) {
+            uint8_t count = peerFifoFull.load(std::memory_order_relaxed);
+            // what the peer counted before we heard from it is not ours
+            if(!synced) {
+                lastPeerFifoFull = count;
+                synced = true;
+            }
+            if(count != lastPeerFifoFull && (windowFrames >= TX_PACER_HOLD_FRAMES || !heldBack)) {
+                lastPeerFifoFull = count;
+                setGap(std::max(currentUs * 2, currentUs + TX_PACER_STEP_US));
+                raised.fetch_add(1, std::memory_order_relaxed);
+                heldBack = true;
+                windowFrames = 0;
+                windowResends = 0;
+                return;
+            }
+        }
+        windowFrames += frames + resends;
+        windowResends += resends;
+        if(windowFrames < TX_PACER_WINDOW_FRAMES) {
+            return;
+        }
+        double loss = static_cast<double>(windowResends) / windowFrames;
+        if(loss > lastLoss * TX_PACER_LOSS_RISE + TX_PACER_LOSS_MIN) {
+            setGap(currentUs + TX_PACER_STEP_US);
+            raised.fetch_add(1, std::memory_order_relaxed);
+        } else if(currentUs > gapUs) {
+            setGap(currentUs - std::max(currentUs / 4, TX_PACER_STEP_US));
+            lowered.fetch_add(1, std::memory_order_relaxed);
+        }
+        lastLoss = loss;
+        heldBack = false;
+        windowFrames = 0;
+        windowResends = 0;
+    }
+
+    // the peer restarted, its count starts again
+    void reset() {
+        peerReported.store(false, std::memory_order_relaxed);
+        synced = false;
+    }
+
+    // set before the threads start
+    int gapUs;          // the least gap between two data frames (--tx-gap-us)
+    bool adaptive;
+
+    std::atomic<uint8_t> peerFifoFull;
+    std::atomic<uint64_t> raised;
+    std::atomic<uint64_t> lowered;
+
+private:
+    void setGap(int us) {
+        currentUs = std::max(gapUs, std::min(us, TX_PACER_MAX_US));
+        txArbiter().setGapUs(currentUs);
+    }
+
+    // only the sender thread uses these (besides the reports of the peer)
+    int currentUs;
+    uint8_t lastPeerFifoFull;
+    bool synced;
+    bool heldBack;      // the gap was widened for a full FIFO, the next report counts after TX_PACER_HOLD_FRAMES
+    std::atomic<bool> peerReported;
+    int windowFrames;
+    int windowResends;
+    double lastLoss;
+};
+
+// the one pacer of the send radio
+inline TxPacer& txPacer() {
+    static TxPacer instance;
+    return instance;
+}
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef UDP_LINK_H
+#define UDP_LINK_H
+
+// A stand-in for the two nRF24 radios (--udp-link): the frames go as udp datagrams of up to UDP_FRAME_SIZE bytes to
+// the other station, over ethernet, wifi or the loopback of two network namespaces. The ARQ core is the same, only its
+// frame geometry is larger (see frameGeometry.h), so the link technologies can be compared and the stack tested
+// without radios. One socket is both radios: the tx arbiter writes to it, the receiver reads from it.
+// Datagrams from other addresses than the peer are dropped, the link has no security of its own.
+
+#include <atomic>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "controlFrames.h"
+#include "asyncLog.h"
+
+#define UDP_FRAME_SIZE LINK_FRAME_MAX
+// how long available() waits for a datagram, so the receiver does not spin on the socket
+#define UDP_LINK_WAIT_MS 1
+
+class UdpLink {
+public:
+    UdpLink() : enabled(false), framesSent(0), framesReceived(0), framesDropped(0), localPort(0), fd(-1), length(0) {
+        memset(&peer, 0, sizeof(peer));
+    }
+
+    // "local port,peer address:peer port", e.g. 7000,192.168.1.20:7000
+    bool configure(const char* spec) {
+        std::string value = spec;
+        size_t comma = value.find(',');
+        size_t colon = value.rfind(':');
+        if(comma == std::string::npos || colon == std::string::npos || colon < comma) {
+            return false;
+        }
+        int local = atoi(value.substr(0, comma).c_str());
+        int remote = atoi(value.substr(colon + 1).c_str());
+        std::string address = value.substr(comma + 1, colon - comma - 1);
+        if(local <= 0 || local > 65535 || remote <= 0 || remote > 65535) {
+            return false;
+        }
+        peer.sin_family = AF_INET;
+        peer.sin_port = htons(static_cast<uint16_t>(remote));
+        if(inet_pton(AF_INET, address.c_str(), &peer.sin_addr) != 1) {
+            return false;
+        }
+        localPort = static_cast<uint16_t>(local);
+        enabled = true;
+        return true;
+    }
+
+    bool open() {
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if(fd < 0) {
+            perror("Failed to open udp link socket");
+            return false;
+        }
+        struct sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        local.sin_port = htons(localPort);
+        if(bind(fd, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)) < 0) {
+            perror("Failed to bind udp link socket");
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    // ---- the calls of RF24 used by the ARQ core and the tx arbiter ----
+
+    bool available() {
+        if(length != 0) {
+            return true;
+        }
+        struct pollfd readable;
+        readable.fd = fd;
+        readable.events = POLLIN;
+        if(poll(&readable, 1, UDP_LINK_WAIT_MS) <= 0) {
+            return false;
+        }
+        struct sockaddr_in from;
+        socklen_t fromLength = sizeof(from);
+        ssize_t received = recvfrom(fd, frame, sizeof(frame), MSG_DONTWAIT | MSG_TRUNC, reinterpret_cast<struct sockaddr*>(&from), &fromLength);
+        if(received <= 0) {
+            return false;
+        }
+        if(from.sin_addr.s_addr != peer.sin_addr.s_addr || from.sin_port != peer.sin_port) {
+            framesDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        framesReceived.fetch_add(1, std::memory_order_relaxed);
+        // a longer datagram than a frame is reported like a corrupted radio frame (length 0)
+        length = received > UDP_FRAME_SIZE ? -1 : static_cast<int>(received);
+        return true;
+    }
+
+    uint8_t getDynamicPayloadSize() {
+        if(length < 0) {
+            length = 0;
+            return 0;
+        }
+        return static_cast<uint8_t>(length);
+    }
+
+    // a socket has no 3 frame FIFO, its buffer is large
+    bool rxFifoFull() {
+        return false;
+    }
+
+    void read(void* buffer, uint8_t size) {
+        memcpy(buffer, frame, size);
+        length = 0;
+    }
+
+    bool write(const void* buffer, uint8_t size) {
+        if(sendto(fd, buffer, size, 0, reinterpret_cast<const struct sockaddr*>(&peer), sizeof(peer)) != size) {
+            LOG_DEBUG(LOG_SEND, "Failed to send a frame on the udp link, errno = {}", errno);
+            return false;
+        }
+        framesSent.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool enabled;   // set before the threads start
+
+    // statistics
+    std::atomic<uint64_t> framesSent;
+    std::atomic<uint64_t> framesReceived;
+    std::atomic<uint64_t> framesDropped;    // from another address than the peer
+
+private:
+    uint16_t localPort;
+    struct sockaddr_in peer;
+    int fd;
+    // the datagram read by available(), until the receiver reads it (only the receiver thread uses these)
+    int length;
+    uint8_t frame[UDP_FRAME_SIZE];
+};
+
+// the one udp link of the program
+inline UdpLink& udpLink() {
+    static UdpLink instance;
+    return instance;
+}
+
+#endif
@@ -0,0 +1,835 @@
+// Discrete-event simulator of our ARQ protocols, for sweeping the protocol parameters faster than real time.
+// The sender and receiver logic follows sendData/receiveData of ARQ/ourArq.cpp (positive acks, "ack")
+// and ARQ/negAckArq.cpp (negative acks, "nak"), but the radios, the sleeps and the tun interface are replaced
+// by a virtual clock with modeled SPI upload time, frame airtime, 3 deep RX FIFOs and a loss model.
+// Every combination of the given parameter lists is simulated and printed as one line of CSV.
+//
+// compile: g++ -std=c++11 -O2 ArqSimulator.cpp -o arqSimulator
+// example: ./arqSimulator --strategy ack,nak --loss 0,0.01,0.05 --size 100,1000,1500 --timeout-us 500,1000,2000 > sweep.csv
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <string>
+#include <sstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+// virtual time in nanoseconds
+typedef int64_t SimTime;
+
+const SimTime MICROSECOND = 1000;
+const SimTime MILLISECOND = 1000 * MICROSECOND;
+const SimTime SECOND = 1000 * MILLISECOND;
+
+// the CRC32C the ARQ binaries put behind every ip packet (ARQ/crc32c.h), the fragments carry it
+const int CRC_SIZE = 4;
+// with --psk the packet is sealed before the crc: an 8 byte counter and a 16 byte tag (ARQ/linkCrypto.h)
+const int SEAL_OVERHEAD = 24;
+
+// parameters of one simulation run
+struct Parameters {
+    std::string strategy;       // "ack" (ourArq.cpp) or "nak" (negAckArq.cpp)
+    int packetSize;             // size of the ip packets in bytes
+    double lossRate;            // average frame loss rate of both channels
+    double burstLength;         // mean length of a loss burst in frames (1 = independent losses)
+    SimTime timeout;            // the sleep_for in the sender loop
+    SimTime timerSlack;         // how much longer than asked sleep_for sleeps on the raspberry
+    int fifoDepth;              // RX FIFO depth of the nRF24
+    SimTime spiTime;            // time to move one frame over SPI (upload to the TX FIFO / read from the RX FIFO)
+    SimTime settleTime;         // TX settling time of the nRF24 before the frame goes on air
+    double dataRate;            // on air bit rate
+    int payloadSize;            // static payload size, every frame is padded to it on air (unless dynamicPayload)
+    bool dynamicPayload;        // frames go on air with their real length, like the ARQ binaries send them
+    bool sealed;                // the packets carry the overhead of --psk
+    SimTime processTime;        // time to check the reassembled packet with libtins and write it to tun
+    double packetRate;          // offered packets per second per direction (0 = always a packet waiting)
+    bool bidirectional;         // both stations send data
+    double duration;            // simulated seconds
+    unsigned seed;
+};
+
+// ---------------------------------------------------------------------------------------------------------
+// event queue with the virtual clock
+
+class Simulator {
+public:
+    Simulator() : currentTime(0), order(0) {}
+
+    SimTime now() const {
+        return currentTime;
+    }
+
+    void at(SimTime time, std::function<void()> action) {
+        Event event;
+        event.time = time;
+        event.order = order++;
+        event.action = action;
+        events.push(event);
+    }
+
+    void after(SimTime delay, std::function<void()> action) {
+        at(currentTime + delay, action);
+    }
+
+    void runUntil(SimTime end) {
+        while(!events.empty() && events.top().time <= end) {
+            Event event = events.top();
+            events.pop();
+            currentTime = event.time;
+            event.action();
+        }
+        currentTime = end;
+    }
+
+private:
+    struct Event {
+        SimTime time;
+        uint64_t order;     // events at the same time run in the order they were scheduled
+        std::function<void()> action;
+    };
+    struct EventLater {
+        bool operator()(const Event& a, const Event& b) const {
+            return a.time > b.time || (a.time == b.time && a.order > b.order);
+        }
+    };
+
+    SimTime currentTime;
+    uint64_t order;
+    std::priority_queue<Event, std::vector<Event>, EventLater> events;
+};
+
+// ---------------------------------------------------------------------------------------------------------
+// radio model
+
+struct Frame {
+    uint8_t data[32];
+    uint8_t length;
+};
+
+struct Statistics {
+    Statistics() : framesSent(0), framesLost(0), fifoOverflows(0), hadToResend(0), delivered(0), deliveredBytes(0), misdelivered(0) {}
+
+    uint64_t framesSent;
+    uint64_t framesLost;
+    uint64_t fifoOverflows;
+    uint64_t hadToResend;
+    uint64_t delivered;
+    uint64_t deliveredBytes;
+    uint64_t misdelivered;
+    std::vector<double> latencies;  // in milliseconds
+};
+
+// Gilbert-Elliott loss model, with burst length 1 it is independent (Bernoulli) loss
+class LossModel {
+public:
+    LossModel(double lossRate, double burstLength, std::mt19937& random) : lossRate(lossRate), burstLength(burstLength), bad(false), random(random), uniform(0.0, 1.0) {}
+
+    bool lose() {
+        if(lossRate <= 0.0) {
+            return false;
+        }
+        if(burstLength <= 1.0) {
+            return uniform(random) < lossRate;
+        }
+        // leaving the bad state with 1/burstLength keeps the bursts burstLength long on average,
+        // entering it is chosen so that the long term loss rate is lossRate
+        double toGood = 1.0 / burstLength;
+        double toBad = lossRate * toGood / (1.0 - lossRate);
+        if(bad) {
+            bad = uniform(random) >= toGood;
+        } else {
+            bad = uniform(random) < toBad;
+        }
+        return bad;
+    }
+
+private:
+    double lossRate;
+    double burstLength;
+    bool bad;
+    std::mt19937& random;
+    std::uniform_real_distribution<double> uniform;
+};
+
+class ReceiveThread;
+
+// the transmitting radio of a station, write() blocks the calling thread until the frame is on air (no auto ack)
+class TransmitRadio {
+public:
+    TransmitRadio(Simulator& sim, const Parameters& params, Statistics& stats, LossModel& loss)
+        : sim(sim), params(params), stats(stats), loss(loss), peer(NULL), busyUntil(0) {}
+
+    void connect(ReceiveThread* receiver) {
+        peer = receiver;
+    }
+
+    SimTime airtime(uint8_t length) const {
+        // preamble + address + packet control field + payload + crc
+        double bits = 8.0 * (1 + 3 + (params.dynamicPayload ? length : params.payloadSize) + 2) + 9;
+        return static_cast<SimTime>(bits / params.dataRate * SECOND);
+    }
+
+    // the two threads of a station share the radio, their writes go out one after another
+    void write(const uint8_t* data, uint8_t length, std::function<void()> done);
+
+private:
+    Simulator& sim;
+    const Parameters& params;
+    Statistics& stats;
+    LossModel& loss;
+    ReceiveThread* peer;
+    SimTime busyUntil;
+};
+
+// the receiving radio with its RX FIFO and the thread draining it (the loop in receiveData)
+class ReceiveThread {
+public:
+    typedef std::function<void(const Frame&, std::function<void()>)> Handler;
+
+    ReceiveThread(Simulator& sim, const Parameters& params, Statistics& stats) : sim(sim), params(params), stats(stats), busy(false) {}
+
+    void setHandler(Handler h) {
+        handler = h;
+    }
+
+    void arrive(const Frame& frame) {
+        if(static_cast<int>(fifo.size()) >= params.fifoDepth) {
+            ++stats.fifoOverflows;
+            return;
+        }
+        fifo.push_back(frame);
+        if(!busy) {
+            pump();
+        }
+    }
+
+private:
+    void pump() {
+        if(fifo.empty()) {
+            busy = false;
+            return;
+        }
+        busy = true;
+        Frame frame = fifo.front();
+        // the frame leaves the FIFO only after it has been read over SPI
+        sim.after(params.spiTime, [this, frame]() {
+            fifo.pop_front();
+            handler(frame, [this]() { pump(); });
+        });
+    }
+
+    Simulator& sim;
+    const Parameters& params;
+    Statistics& stats;
+    Handler handler;
+    std::deque<Frame> fifo;
+    bool busy;
+};
+
+void TransmitRadio::write(const uint8_t* data, uint8_t length, std::function<void()> done) {
+    Frame frame;
+    memset(frame.data, 0, sizeof(frame.data));
+    memcpy(frame.data, data, length);
+    frame.length = length;
+    SimTime start = std::max(sim.now(), busyUntil);
+    SimTime end = start + params.spiTime + params.settleTime + airtime(length);
+    busyUntil = end;
+    ++stats.framesSent;
+    bool lost = loss.lose();
+    if(lost) {
+        ++stats.framesLost;
+    }
+    ReceiveThread* receiver = peer;
+    sim.at(end, [receiver, frame, lost, done]() {
+        if(!lost) {
+            receiver->arrive(frame);
+        }
+        done();
+    });
+}
+
+// runs the given writes one after another, then calls done
+void writeAll(TransmitRadio& radio, std::shared_ptr<std::vector<Frame> > frames, size_t index, std::function<void()> done) {
+    if(index >= frames->size()) {
+        done();
+        return;
+    }
+    const Frame& frame = (*frames)[index];
+    radio.write(frame.data, frame.length, [&radio, frames, index, done]() {
+        writeAll(radio, frames, index + 1, done);
+    });
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// one station: traffic source, sender thread and receiver thread sharing the ack state, like in the ARQ binaries
+
+struct QueuedPacket {
+    uint32_t id;
+    SimTime enqueued;
+    std::vector<uint8_t> data;
+};
+
+class Station {
+public:
+    Station(Simulator& sim, const Parameters& params, Statistics& stats, TransmitRadio& radio, ReceiveThread& receiver, std::mt19937& random)
+        : sim(sim), params(params), stats(stats), radio(radio), receiver(receiver), random(random), peer(NULL),
+          nextId(0), lastFinishedId(0), lastFinishedEnqueued(-1), senderIdle(true), sendingAltBool(true), packetReceivedOnOtherSide(false), fragmentsToSend(0), someAckNotReceived(false),
+          receivingAltBool(true), sizeKnown(false), fragmentsReceived(0), fragmentsToReceive(0), currentPacketSize(0), expectedId(0) {
+        memset(ackList, 0, sizeof(ackList));
+        memset(fragmentStatus, 0, sizeof(fragmentStatus));
+        memset(buffer, 0, sizeof(buffer));
+        receiver.setHandler([this](const Frame& frame, std::function<void()> done) { receive(frame, done); });
+    }
+
+    void setPeer(Station* station) {
+        peer = station;
+    }
+
+    // starts the traffic source
+    void startTraffic() {
+        if(params.packetRate <= 0.0) {
+            enqueue();
+        } else {
+            scheduleArrival();
+        }
+    }
+
+    // latency is measured from the moment the packet was read from the interface
+    SimTime enqueueTime(uint32_t id) const {
+        for(size_t i = 0; i < queue.size(); ++i) {
+            if(queue[i].id == id) {
+                return queue[i].enqueued;
+            }
+        }
+        return lastFinishedId == id ? lastFinishedEnqueued : -1;
+    }
+
+private:
+    bool positive() const {
+        return params.strategy == "ack";
+    }
+
+    void scheduleArrival() {
+        std::exponential_distribution<double> interval(params.packetRate);
+        SimTime delay = static_cast<SimTime>(interval(random) * SECOND);
+        sim.after(delay, [this]() {
+            enqueue();
+            scheduleArrival();
+        });
+    }
+
+    void enqueue() {
+        QueuedPacket packet;
+        packet.id = nextId++;
+        packet.enqueued = sim.now();
+        // as it goes on the wire: sealed (the header has the sealed length then), the crc behind it (not checked, the
+        // simulated radios lose frames but do not corrupt them)
+        int sealedSize = params.packetSize + (params.sealed ? SEAL_OVERHEAD : 0);
+        packet.data.assign(sealedSize + CRC_SIZE, 0);
+        // looks like an ipv4 header (so it passes the check on the receiving side), carries our id in the ip id field
+        packet.data[0] = 0x45;
+        packet.data[2] = static_cast<uint8_t>(sealedSize >> 8);
+        packet.data[3] = static_cast<uint8_t>(sealedSize & 0xFF);
+        for(int i = 0; i < 4 && 4 + i < params.packetSize; ++i) {
+            packet.data[4 + i] = static_cast<uint8_t>(packet.id >> (8 * (3 - i)));
+        }
+        queue.push_back(packet);
+        if(senderIdle) {
+            senderIdle = false;
+            sendPacket();
+        }
+    }
+
+    // ---- sender thread (sendData) ----
+
+    // wire format v2: no start message, the receiver takes the size from the ip header in fragment 1
+    Frame pollFrame() const {
+        Frame frame;
+        frame.data[0] = (sendingAltBool ? 0x40 : 0) + 63;
+        frame.data[1] = 5;      // CONTROL_POLL
+        frame.data[2] = fragmentsToSend;
+        frame.length = 3;
+        return frame;
+    }
+
+    Frame dataFrame(int seq) const {
+        const std::vector<uint8_t>& data = queue.front().data;
+        Frame frame;
+        frame.data[0] = (sendingAltBool ? 0x40 : 0) + seq;
+        int index = (seq - 1) * 31;
+        int cap = std::min(31, static_cast<int>(data.size()) - index);
+        memcpy(frame.data + 1, &data[index], cap);
+        frame.length = cap + 1;
+        return frame;
+    }
+
+    void sendPacket() {
+        if(queue.empty()) {
+            senderIdle = true;
+            return;
+        }
+        fragmentsToSend = static_cast<uint8_t>(std::ceil(queue.front().data.size() / 31.0));
+        std::shared_ptr<std::vector<Frame> > frames(new std::vector<Frame>());
+        for(int seq = 1; seq <= fragmentsToSend; ++seq) {
+            frames->push_back(dataFrame(seq));
+        }
+        writeAll(radio, frames, 0, [this]() {
+            if(positive()) {
+                someAckNotReceived = true;
+                ackWaitLoop();
+            } else {
+                sim.after(params.timeout + params.timerSlack, [this]() { negAckLoop(); });
+            }
+        });
+    }
+
+    // while(someAckNotReceived) { sleep; resend everything without an ack }
+    void ackWaitLoop() {
+        if(!someAckNotReceived) {
+            finishPacket();
+            return;
+        }
+        sim.after(params.timeout + params.timerSlack, [this]() {
+            someAckNotReceived = false;
+            resendUnacked(1);
+        });
+    }
+
+    void resendUnacked(int seq) {
+        for(; seq <= fragmentsToSend; ++seq) {
+            if(ackList[seq] != 1) {
+                someAckNotReceived = true;
+                ++stats.hadToResend;
+                Frame frame = dataFrame(seq);
+                radio.write(frame.data, frame.length, [this, seq]() { resendUnacked(seq + 1); });
+                return;
+            }
+        }
+        ackWaitLoop();
+    }
+
+    // while(!packetReceivedOnOtherSide) { resend neg-acked; sleep; poll; sleep }
+    void negAckLoop() {
+        if(packetReceivedOnOtherSide) {
+            finishPacket();
+            return;
+        }
+        resendNegAcked(1);
+    }
+
+    void resendNegAcked(int seq) {
+        for(; seq <= fragmentsToSend; ++seq) {
+            if(ackList[seq] == 1) {
+                ackList[seq] = 0;
+                ++stats.hadToResend;
+                Frame frame = dataFrame(seq);
+                radio.write(frame.data, frame.length, [this, seq]() { resendNegAcked(seq + 1); });
+                return;
+            }
+        }
+        sim.after(params.timeout + params.timerSlack, [this]() {
+            if(packetReceivedOnOtherSide) {
+                sim.after(params.timeout + params.timerSlack, [this]() { negAckLoop(); });
+                return;
+            }
+            Frame frame = pollFrame();
+            radio.write(frame.data, frame.length, [this]() {
+                sim.after(params.timeout + params.timerSlack, [this]() { negAckLoop(); });
+            });
+        });
+    }
+
+    void finishPacket() {
+        sendingAltBool = !sendingAltBool;
+        packetReceivedOnOtherSide = false;
+        memset(ackList, 0, sizeof(ackList));
+        lastFinishedId = queue.front().id;
+        lastFinishedEnqueued = queue.front().enqueued;
+        queue.pop_front();
+        if(params.packetRate <= 0.0) {
+            enqueue();
+        }
+        sendPacket();
+    }
+
+    // ---- receiver thread (receiveData) ----
+
+    void receive(const Frame& frame, std::function<void()> done) {
+        std::shared_ptr<std::vector<Frame> > writes(new std::vector<Frame>());
+        bool deliver = false;
+        handleFrame(frame.data, *writes, deliver);
+        // the acknowledgements are written from the receiving thread, it can't drain the FIFO meanwhile
+        writeAll(radio, writes, 0, [this, deliver, done]() {
+            if(deliver) {
+                sim.after(params.processTime, done);
+            } else {
+                done();
+            }
+        });
+    }
+
+    static Frame controlFrame(uint8_t byte) {
+        Frame frame;
+        frame.data[0] = byte;
+        frame.length = 1;
+        return frame;
+    }
+
+    void handleFrame(const uint8_t* currentMsg, std::vector<Frame>& writes, bool& deliver) {
+        uint8_t header = currentMsg[0];
+        bool receivedAltBool = (header & 0x40) != 0;
+        uint8_t seq = header & 0x3F;
+        bool isAck = (header & 0x80) != 0;
+
+        if(positive() && seq > 62) {
+            return;
+        }
+        if(!isAck && seq == 63) {
+            // the poll of the neg-ack sender
+            if(receivedAltBool != receivingAltBool) {
+                writes.push_back(controlFrame(receivedAltBool ? 0xff : 0xbf));
+                return;
+            }
+            uint8_t fragments = sizeKnown ? fragmentsToReceive : currentMsg[2];
+            for(uint8_t i = 1; i <= fragments && i <= 62; ++i) {
+                if(fragmentStatus[i] != 1) {
+                    fragmentStatus[i] = 2;
+                    writes.push_back(controlFrame((receivingAltBool ? 0xc0 : 0x80) + i));
+                }
+            }
+            return;
+        }
+        if(isAck) {
+            if(receivedAltBool != sendingAltBool) {
+                return;
+            }
+            if(!positive() && seq == 63) {
+                packetReceivedOnOtherSide = true;
+            } else {
+                ackList[seq] = 1;
+            }
+            return;
+        }
+        if(receivedAltBool != receivingAltBool) {
+            if(positive()) {
+                writes.push_back(controlFrame(header | 0x80));
+            } else {
+                writes.push_back(controlFrame(receivedAltBool ? 0xff : 0xbf));
+            }
+            return;
+        } else if(positive() && seq > 1) {
+            writes.push_back(controlFrame(header | 0x80));
+        }
+
+        if(seq == 0) {
+            return;
+        }
+        // fragment 1 starts with the ip header, its total length tells how many fragments the packet has
+        if(seq == 1 && fragmentStatus[1] != 1) {
+            uint16_t size = (currentMsg[3] << 8) | currentMsg[4];
+            if((currentMsg[1] >> 4) != 4 || size < 20 || size + CRC_SIZE > 62 * 31) {
+                if(!positive()) {
+                    fragmentStatus[1] = 2;
+                    writes.push_back(controlFrame(header | 0x80));
+                }
+                return;
+            }
+            sizeKnown = true;
+            currentPacketSize = size;
+            fragmentsToReceive = static_cast<uint8_t>((size + CRC_SIZE + 30) / 31);
+        }
+        if(positive() && seq == 1) {
+            writes.push_back(controlFrame(header | 0x80));
+        }
+        if(fragmentStatus[seq] != 1) {
+            fragmentStatus[seq] = 1;
+            if(!positive()) {
+                for(uint8_t i = 1; i < seq; ++i) {
+                    if(fragmentStatus[i] == 0) {
+                        fragmentStatus[i] = 2;
+                        writes.push_back(controlFrame((receivingAltBool ? 0xc0 : 0x80) + i));
+                    }
+                }
+            }
+            memcpy(&buffer[(seq - 1) * 31], currentMsg + 1, 31);
+            ++fragmentsReceived;
+        } else {
+            return;
+        }
+
+        if(sizeKnown && fragmentsReceived == fragmentsToReceive) {
+            uint8_t corruptedSeqs = 0;
+            for(int i = 1; i <= fragmentsToReceive; ++i) {
+                if(fragmentStatus[i] != 1) {
+                    ++corruptedSeqs;
+                }
+            }
+            if(corruptedSeqs != 0) {
+                fragmentsReceived -= corruptedSeqs;
+                return;
+            }
+            if(!positive()) {
+                writes.push_back(controlFrame(receivingAltBool ? 0xff : 0xbf));
+            }
+            receivingAltBool = !receivingAltBool;
+            deliverPacket();
+            deliver = true;
+            memset(buffer, 0, sizeof(buffer));
+            sizeKnown = false;
+            fragmentsReceived = 0;
+            fragmentsToReceive = 0;
+            currentPacketSize = 0;
+            memset(fragmentStatus, 0, sizeof(fragmentStatus));
+        }
+    }
+
+    // checks that the reassembled packet is the next one the peer sent and records its latency
+    void deliverPacket() {
+        uint32_t id = (buffer[4] << 24) | (buffer[5] << 16) | (buffer[6] << 8) | buffer[7];
+        uint16_t size = (buffer[2] << 8) | buffer[3];
+        if(buffer[0] != 0x45 || size != currentPacketSize || id != expectedId) {
+            ++stats.misdelivered;
+            expectedId = id + 1;
+            return;
+        }
+        ++expectedId;
+        ++stats.delivered;
+        // the goodput counts the ip packet, not the seal and the crc
+        stats.deliveredBytes += currentPacketSize - (params.sealed ? SEAL_OVERHEAD : 0);
+        SimTime enqueued = peer->enqueueTime(id);
+        if(enqueued >= 0) {
+            stats.latencies.push_back(static_cast<double>(sim.now() + params.processTime - enqueued) / MILLISECOND);
+        }
+    }
+
+    Simulator& sim;
+    const Parameters& params;
+    Statistics& stats;
+    TransmitRadio& radio;
+    ReceiveThread& receiver;
+    std::mt19937& random;
+    Station* peer;
+
+    // traffic source
+    std::deque<QueuedPacket> queue;
+    uint32_t nextId;
+    uint32_t lastFinishedId;
+    SimTime lastFinishedEnqueued;
+
+    // state shared between the threads (fragmentList / negAckArray, sendingAltBool, packetReceivedOnOtherSide)
+    bool senderIdle;
+    int ackList[64];
+    bool sendingAltBool;
+    bool packetReceivedOnOtherSide;
+    uint8_t fragmentsToSend;
+    bool someAckNotReceived;
+
+    // receiver thread state
+    bool receivingAltBool;
+    bool sizeKnown;
+    uint8_t fragmentsReceived;
+    uint8_t fragmentsToReceive;
+    uint16_t currentPacketSize;
+    uint8_t fragmentStatus[64];     // 0 = unknown, 1 = received, 2 = neg-ack sent (only 0/1 used with positive acks)
+    uint8_t buffer[2048];
+    uint32_t expectedId;
+};
+
+// ---------------------------------------------------------------------------------------------------------
+// sweep driver
+
+Statistics simulate(const Parameters& params) {
+    Statistics stats;
+    std::mt19937 random(params.seed);
+    Simulator sim;
+    LossModel lossAtoB(params.lossRate, params.burstLength, random);
+    LossModel lossBtoA(params.lossRate, params.burstLength, random);
+
+    ReceiveThread receiverA(sim, params, stats);
+    ReceiveThread receiverB(sim, params, stats);
+    TransmitRadio radioA(sim, params, stats, lossAtoB);
+    TransmitRadio radioB(sim, params, stats, lossBtoA);
+    radioA.connect(&receiverB);
+    radioB.connect(&receiverA);
+
+    Station stationA(sim, params, stats, radioA, receiverA, random);
+    Station stationB(sim, params, stats, radioB, receiverB, random);
+    stationA.setPeer(&stationB);
+    stationB.setPeer(&stationA);
+
+    stationA.startTraffic();
+    if(params.bidirectional) {
+        stationB.startTraffic();
+    }
+    sim.runUntil(static_cast<SimTime>(params.duration * SECOND));
+    return stats;
+}
+
+double percentile(std::vector<double>& values, double p) {
+    if(values.empty()) {
+        return 0.0;
+    }
+    size_t index = static_cast<size_t>(p * (values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        if(!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<double> numberList(const std::string& list) {
+    std::vector<double> numbers;
+    std::vector<std::string> items = splitList(list);
+    for(size_t i = 0; i < items.size(); ++i) {
+        numbers.push_back(atof(items[i].c_str()));
+    }
+    return numbers;
+}
+
+void printUsage(const char* name) {
+    std::cerr << "Usage: " << name << " [options], lists are comma separated, every combination is simulated" << std::endl
+              << "  --strategy ack,nak     acknowledgement strategy (ourArq.cpp / negAckArq.cpp)" << std::endl
+              << "  --size LIST            ip packet sizes in bytes (default 1000)" << std::endl
+              << "  --loss LIST            frame loss rate (default 0)" << std::endl
+              << "  --burst LIST           mean loss burst length in frames (default 1)" << std::endl
+              << "  --timeout-us LIST      sender sleep between resend rounds (default 1000)" << std::endl
+              << "  --fifo LIST            RX FIFO depth (default 3)" << std::endl
+              << "  --rate LIST            offered packets/s per direction, 0 = saturated (default 0)" << std::endl
+              << "  --spi-us N             SPI time per frame (default 40)" << std::endl
+              << "  --process-us N         libtins check + tun write per packet (default 100)" << std::endl
+              << "  --slack-us N           sleep_for overshoot (default 60)" << std::endl
+              << "  --duration S           simulated seconds per run (default 60)" << std::endl
+              << "  --seed N               random seed (default 1)" << std::endl
+              << "  --bidirectional        both stations send data" << std::endl
+              << "  --static-payload       pad every frame to 32 bytes on air (no dynamic payloads)" << std::endl
+              << "  --psk                  the packets carry the counter and tag of the sealing (24 bytes)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> strategies(1, "ack");
+    std::vector<double> sizes(1, 1000), losses(1, 0.0), bursts(1, 1.0), timeouts(1, 1000), fifos(1, 3), rates(1, 0.0);
+
+    Parameters base;
+    base.spiTime = 40 * MICROSECOND;
+    base.settleTime = 130 * MICROSECOND;
+    base.dataRate = 2e6;
+    base.payloadSize = 32;
+    base.dynamicPayload = true;
+    base.sealed = false;
+    base.processTime = 100 * MICROSECOND;
+    base.timerSlack = 60 * MICROSECOND;
+    base.bidirectional = false;
+    base.duration = 60.0;
+    base.seed = 1;
+
+    for(int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(option == "--bidirectional") {
+            base.bidirectional = true;
+        } else if(option == "--static-payload") {
+            base.dynamicPayload = false;
+        } else if(option == "--psk") {
+            base.sealed = true;
+        } else if(option == "--strategy" && hasValue) {
+            strategies = splitList(argv[++i]);
+        } else if(option == "--size" && hasValue) {
+            sizes = numberList(argv[++i]);
+        } else if(option == "--loss" && hasValue) {
+            losses = numberList(argv[++i]);
+        } else if(option == "--burst" && hasValue) {
+            bursts = numberList(argv[++i]);
+        } else if(option == "--timeout-us" && hasValue) {
+            timeouts = numberList(argv[++i]);
+        } else if(option == "--fifo" && hasValue) {
+            fifos = numberList(argv[++i]);
+        } else if(option == "--rate" && hasValue) {
+            rates = numberList(argv[++i]);
+        } else if(option == "--spi-us" && hasValue) {
+            base.spiTime = static_cast<SimTime>(atof(argv[++i]) * MICROSECOND);
+        } else if(option == "--process-us" && hasValue) {
+            base.processTime = static_cast<SimTime>(atof(argv[++i]) * MICROSECOND);
+        } else if(option == "--slack-us" && hasValue) {
+            base.timerSlack = static_cast<SimTime>(atof(argv[++i]) * MICROSECOND);
+        } else if(option == "--duration" && hasValue) {
+            base.duration = atof(argv[++i]);
+        } else if(option == "--seed" && hasValue) {
+            base.seed = static_cast<unsigned>(atoi(argv[++i]));
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    for(size_t i = 0; i < strategies.size(); ++i) {
+        if(strategies[i] != "ack" && strategies[i] != "nak") {
+            std::cerr << "Unknown strategy: " << strategies[i] << "; should be: [ack | nak]" << std::endl;
+            return 1;
+        }
+    }
+    // 62 fragments of 31 bytes carry the packet, its seal and its crc
+    int maxSize = 62 * 31 - CRC_SIZE - (base.sealed ? SEAL_OVERHEAD : 0);
+    for(size_t i = 0; i < sizes.size(); ++i) {
+        if(sizes[i] < 20 || sizes[i] > maxSize) {
+            std::cerr << "Packet size must be between 20 and " << maxSize << " bytes" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "strategy,packet_size,loss,burst,timeout_us,fifo_depth,rate_pps,bidirectional,dynamic_payload,sealed,duration_s,"
+              << "delivered,goodput_kbps,latency_mean_ms,latency_p50_ms,latency_p99_ms,frames_sent,frames_lost,resent,fifo_overflows,misdelivered" << std::endl;
+
+    for(size_t s = 0; s < strategies.size(); ++s)
+    for(size_t z = 0; z < sizes.size(); ++z)
+    for(size_t l = 0; l < losses.size(); ++l)
+    for(size_t b = 0; b < bursts.size(); ++b)
+    for(size_t t = 0; t < timeouts.size(); ++t)
+    for(size_t f = 0; f < fifos.size(); ++f)
+    for(size_t r = 0; r < rates.size(); ++r) {
+        Parameters params = base;
+        params.strategy = strategies[s];
+        params.packetSize = static_cast<int>(sizes[z]);
+        params.lossRate = losses[l];
+        params.burstLength = bursts[b];
+        params.timeout = static_cast<SimTime>(timeouts[t] * MICROSECOND);
+        params.fifoDepth = static_cast<int>(fifos[f]);
+        params.packetRate = rates[r];
+
+        Statistics stats = simulate(params);
+
+        double mean = 0.0;
+        for(size_t i = 0; i < stats.latencies.size(); ++i) {
+            mean += stats.latencies[i];
+        }
+        if(!stats.latencies.empty()) {
+            mean /= stats.latencies.size();
+        }
+        double goodput = stats.deliveredBytes * 8.0 / params.duration / 1000.0;
+        double p50 = percentile(stats.latencies, 0.5);
+        double p99 = percentile(stats.latencies, 0.99);
+
+        std::cout << params.strategy << "," << params.packetSize << "," << params.lossRate << "," << params.burstLength << ","
+                  << timeouts[t] << "," << params.fifoDepth << "," << params.packetRate << "," << (params.bidirectional ? 1 : 0) << "," << (params.dynamicPayload ? 1 : 0) << ","
+                  << (params.sealed ? 1 : 0) << ","
+                  << params.duration << "," << stats.delivered << "," << goodput << "," << mean << "," << p50 << "," << p99 << ","
+                  << stats.framesSent << "," << stats.framesLost << "," << stats.hadToResend << "," << stats.fifoOverflows << ","
+                  << stats.misdelivered << std::endl;
+    }
+    return 0;
+}